@@ -0,0 +1,140 @@
+#include "bareword.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+    arena_chunk_t* next;
+    size_t size;
+    size_t used;
+};
+
+// Allocations start after the chunk header, rounded up to the alignment
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define CHUNK_DATA(chunk) ((char*)(chunk) + ALIGN_UP(sizeof(arena_chunk_t)))
+
+void arena_init(arena_t* arena) {
+    arena->chunks = NULL;
+    arena->reserved = 0;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    arena_chunk_t* chunk = arena->chunks;
+    size = ALIGN_UP(size);
+    
+    if (!chunk || chunk->size - chunk->used < size) {
+        // Oversized chunks leave room for the allocation to grow in place
+        size_t chunk_size = size * 2 > ARENA_CHUNK_SIZE ? size * 2 : ARENA_CHUNK_SIZE;
+        
+        chunk = malloc(ALIGN_UP(sizeof(arena_chunk_t)) + chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->chunks = chunk;
+        arena->reserved += chunk_size;
+    }
+    
+    void* ptr = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void* arena_grow(arena_t* arena, void* ptr, size_t old_size, size_t new_size) {
+    arena_chunk_t* chunk = arena->chunks;
+    
+    // The latest allocation can be extended where it is
+    if (ptr && chunk && (char*)ptr + ALIGN_UP(old_size) == CHUNK_DATA(chunk) + chunk->used &&
+        chunk->size - chunk->used >= ALIGN_UP(new_size) - ALIGN_UP(old_size)) {
+        chunk->used += ALIGN_UP(new_size) - ALIGN_UP(old_size);
+        return ptr;
+    }
+    
+    void* grown = arena_alloc(arena, new_size);
+    if (grown && ptr) {
+        memcpy(grown, ptr, old_size);
+    }
+    return grown;
+}
+
+void* arena_reserve(arena_t* arena, void* items, int needed, int* capacity, size_t item_size) {
+    if (needed <= *capacity) {
+        return items;
+    }
+    
+    int new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    
+    void* grown = arena_grow(arena, items, item_size * *capacity, item_size * new_capacity);
+    if (grown) {
+        *capacity = new_capacity;
+    }
+    return grown;
+}
+
+void arena_free(arena_t* arena) {
+    arena_chunk_t* chunk = arena->chunks;
+    
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena);
+}
+
+// Room for needed entries at most half full. Growing rehashes into a new
+// array; the old one stays in the arena until the program is freed.
+int hash_index_reserve(arena_t* arena, hash_index_t* index, int needed) {
+    uint32_t capacity = index->entries ? index->mask + 1 : 0;
+    
+    if ((uint64_t)needed * 2 <= capacity) {
+        return 1;
+    }
+    
+    uint32_t new_capacity = capacity > 0 ? capacity * 2 : 64;
+    while ((uint64_t)needed * 2 > new_capacity) {
+        new_capacity *= 2;
+    }
+    hash_entry_t* entries = arena_alloc(arena, sizeof(hash_entry_t) * new_capacity);
+    if (!entries) {
+        return 0;
+    }
+    memset(entries, 0, sizeof(hash_entry_t) * new_capacity);
+    
+    for (uint32_t i = 0; i < capacity; i++) {
+        const hash_entry_t* old = &index->entries[i];
+        
+        if (old->item) {
+            uint32_t slot = old->hash & (new_capacity - 1);
+            while (entries[slot].item) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            entries[slot] = *old;
+        }
+    }
+    index->entries = entries;
+    index->mask = new_capacity - 1;
+    return 1;
+}
+
+// Probe sequence for a hash: callers step through it until they find their
+// key or an empty entry, which is where a new item goes. The index must have
+// been reserved.
+hash_entry_t* hash_index_probe(const hash_index_t* index, uint32_t hash) {
+    return &index->entries[hash & index->mask];
+}
+
+hash_entry_t* hash_index_next(const hash_index_t* index, const hash_entry_t* entry) {
+    return &index->entries[(entry - index->entries + 1) & index->mask];
+}
+
+void hash_index_insert(hash_index_t* index, hash_entry_t* entry, int item, uint32_t hash) {
+    entry->item = item + 1;
+    entry->hash = hash;
+    index->count++;
+}
\ No newline at end of file
@@ -7,12 +7,28 @@
 #include <ctype.h>
 #include <stdint.h>
 
-#define MAX_TOKEN_LENGTH 256
 #define MAX_TOKENS_PER_LINE 16
-#define MAX_LINES 1024
-#define MAX_VARIABLES 256
-#define MAX_LABELS 64
-#define MAX_STRING_LENGTH 512
+
+// Bump allocator: everything a program owns is released with one arena_free
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t* chunks;  // Most recent chunk first
+    size_t reserved;        // Bytes obtained from the system
+} arena_t;
+
+// Open-addressing hash index over an item table, kept in the arena. It only
+// stores each item's position and hash; callers compare the keys.
+typedef struct {
+    int item;               // Item index + 1, 0 for an empty entry
+    uint32_t hash;
+} hash_entry_t;
+
+typedef struct {
+    hash_entry_t* entries;
+    uint32_t mask;          // Capacity - 1, the capacity being a power of two
+    int count;
+} hash_index_t;
 
 typedef enum {
     TOKEN_OPCODE,
@@ -22,12 +38,48 @@ typedef enum {
     TOKEN_COMPARISON
 } token_type_t;
 
+// Text inside the program source, not NUL-terminated
+typedef struct {
+    const char* start;
+    int length;
+} span_t;
+
 typedef struct {
     token_type_t type;
-    char value[MAX_TOKEN_LENGTH];
+    span_t text;        // Strings exclude their quotes
+    int value;          // opcode_t or comparison_t of keywords and operators
     int line_number;
 } token_t;
 
+// Where program output and diagnostics go. Every error message reaches
+// error as line, message and optional detail; write receives output bytes.
+typedef struct {
+    void (*write)(void* user, const char* data, size_t size);
+    void (*error)(void* user, int line, const char* message, span_t detail);
+    void* user;
+} sink_t;
+
+// Structural index of a source text, produced one window at a time by scan.c
+#define SCAN_WINDOW (16 * 1024)
+
+typedef struct {
+    const char* text;
+    size_t size;
+    size_t position;        // Next byte to scan
+    uint64_t in_token;      // Whether the byte before position is inside a token
+    int finished;           // The end-of-source entry has been produced
+    uint32_t* index;        // Offsets of token starts and ends, quotes and newlines
+    size_t count;           // Entries in the current window
+    int kernel;             // Block classifier in use
+} scanner_t;
+
+typedef struct {
+    scanner_t scanner;
+    size_t next;            // Next index entry to read
+    int line_number;        // Line last returned by tokenize_line
+    const sink_t* sink;     // Receives lexical errors
+} lexer_t;
+
 typedef enum {
     OP_SET,     // set var value
     OP_OUT,     // out value
@@ -54,42 +106,296 @@ typedef enum {
 
 typedef struct {
     opcode_t op;
-    char args[4][MAX_TOKEN_LENGTH];
+    span_t args[4];
     int arg_count;
     int line_number;
+    comparison_t cmp;   // Operator of a cmp, decoded by the parser
+    token_type_t types[4];  // Token type of each argument
+    int slots[4];       // Variable slot per argument, -1 if not a variable
+    int target;         // Resolved branch target index for if/goto
 } instruction_t;
 
 typedef struct {
-    char name[MAX_TOKEN_LENGTH];
-    int64_t value;
-} variable_t;
+    span_t name;
+} symbol_t;
 
 typedef struct {
-    char name[MAX_TOKEN_LENGTH];
+    span_t name;
     int instruction_index;
 } label_t;
 
+// Operator tables for the lowered opcodes. COMPARE_OPS is in comparison_t order.
+#define ARITH_OPS(X) X(ADD, +) X(SUB, -) X(MUL, *)
+#define COMPARE_OPS(X) X(EQ, ==) X(NE, !=) X(LT, <) X(LE, <=) X(GT, >) X(GE, >=)
+
+// Lowered opcodes. Value operations come in a register-register (_RR) and a
+// register-immediate (_RI) form, generated from the operator tables, and are
+// laid out as consecutive (_RR, _RI) pairs from BC_SET_RR to BC_BR_GE_RI.
+#define BC_ARITH_ENUM(name, op) BC_##name##_RR, BC_##name##_RI,
+#define BC_COMPARE_ENUM(name, op) BC_CMP_##name##_RR, BC_CMP_##name##_RI,
+#define BC_BRANCH_ENUM(name, op) BC_BR_##name##_RR, BC_BR_##name##_RI,
+typedef enum {
+    BC_SET_RR,      // dst = a
+    BC_SET_RI,      // dst = imm
+    ARITH_OPS(BC_ARITH_ENUM)
+    BC_DIV_RR,      // dst = a / b, checks for zero
+    BC_DIV_RI,      // dst = a / imm, imm is never zero
+    COMPARE_OPS(BC_COMPARE_ENUM)
+    COMPARE_OPS(BC_BRANCH_ENUM)     // dst = a op b, then goto the next word's dst if true
+    BC_OUT_R,       // print slot a
+    BC_OUT_S,       // print string at offset a, b bytes long
+    BC_IF,          // if a goto dst
+    BC_GOTO,        // goto dst
+    BC_HALT,
+    BC_COUNT
+} bytecode_op_t;
+#undef BC_ARITH_ENUM
+#undef BC_COMPARE_ENUM
+#undef BC_BRANCH_ENUM
+
+// Lowered instruction executed by the runtime, 16 bytes. The opcode fixes
+// the kind of every operand.
+typedef struct {
+    uint8_t op;         // bytecode_op_t
+    uint8_t reserved[3];
+    uint32_t dst;       // Destination slot, or branch target for if/goto
+    uint32_t a;         // First source slot, condition for if, or string offset
+    uint32_t b;         // Second source slot, immediate for _RI forms, or string length
+} bytecode_t;
+
+#define IMMEDIATE(x) ((int64_t)(int32_t)(x))
+
+typedef struct {
+    bytecode_t* code;
+    int* lines;                 // Source line of each instruction, for diagnostics
+    int count;
+    int64_t* constants;         // Literal values, occupying slots after the variables
+    int constant_count;
+    int constant_capacity;
+    char* strings;              // NUL-terminated out literals
+    int string_size;
+    int string_capacity;
+    int slot_count;             // Variables, constants and the optimizer's scratch slot
+} compiled_t;
+
+typedef struct {
+    int fused;              // cmp+if pairs fused into compare-and-branch
+    int merged;             // set instructions merged into the following operation
+    int jumps_removed;      // gotos to the next instruction
+    int folded;             // operations replaced by their constant result
+    int branches_resolved;  // ifs on a known condition turned into goto or dropped
+    int dead_removed;       // unreachable instructions and dead stores
+    int propagation_skipped;  // 1 if constant propagation was skipped as too large
+} optimize_stats_t;
+
 typedef struct {
-    instruction_t instructions[MAX_LINES];
+    int start;          // First instruction index
+    int end;            // One past the last instruction index
+    int successors[2];  // Successor block indices
+    int successor_count;
+} block_t;
+
+// All tables grow on demand inside the program's arena. Instruction
+// arguments, symbol and label names point into the source text. Once
+// validated, a program is only read, so contexts on several threads can
+// execute it at the same time.
+typedef struct {
+    arena_t arena;
+    const sink_t* sink;         // Receives parse and validation errors
+    const char* source;         // Program text, mapped or read into the arena
+    size_t source_size;
+    int source_mapped;          // Whether source must be unmapped
+    const void* image;          // Mapped bytecode image compiled points into, if any
+    size_t image_size;
+    instruction_t* instructions;
     int instruction_count;
-    variable_t variables[MAX_VARIABLES];
+    int instruction_capacity;
+    symbol_t* symbols;          // Interned variable names, indexed by slot
     int variable_count;
-    label_t labels[MAX_LABELS];
+    int symbol_capacity;
+    hash_index_t symbol_index;
+    label_t* labels;
     int label_count;
+    int label_capacity;
+    hash_index_t label_index;
+    hash_index_t constant_index;    // Over compiled.constants
+    compiled_t compiled;        // Lowered form executed by the runtime
+    block_t* blocks;            // Control-flow graph over the lowered code
+    int* block_of;              // Block containing each lowered instruction
+    int block_count;
+    int variables_observed;     // Variables are read after the run, so no store to one is dead
 } program_t;
 
+// When buffered program output is passed on to the sink
+typedef enum {
+    FLUSH_LINE,     // After every out
+    FLUSH_FULL,     // When the buffer fills up
+    FLUSH_EXIT      // Only when the program finishes
+} flush_policy_t;
+
+typedef struct {
+    const sink_t* sink;
+    char* buffer;               // Allocated on first output
+    size_t capacity;
+    size_t used;
+    flush_policy_t policy;
+    uint64_t written;           // Bytes passed to the sink
+} output_t;
+
+// Per-instruction counters of the profiling engine, indexed by pc. The
+// extension word of a fused branch counts as the if it was fused from.
+typedef struct {
+    uint64_t* counts;           // Times each instruction ran
+    uint64_t* taken;            // Times an if jumped
+    uint64_t* ticks;            // Clock ticks spent in each instruction
+    int count;
+    const char* clock;          // Unit of ticks, "cycles" or "ns"
+} profile_t;
+
+// Step of an execution trace: the instruction run and the value it stored
+#define TRACE_NO_SLOT UINT32_MAX
+
+typedef struct {
+    uint32_t pc;
+    uint32_t slot;              // Slot written, TRACE_NO_SLOT if none
+    int64_t value;              // Its new value
+} trace_record_t;
+
+typedef enum {
+    TRACE_RUNNING,              // Also what a crashed run leaves behind
+    TRACE_HALTED,
+    TRACE_FAILED
+} trace_status_t;
+
+// Ring buffer the tracing engine records into, mapped from the trace file
+typedef struct {
+    trace_record_t* records;
+    uint32_t mask;              // Capacity - 1, the capacity being a power of two
+    uint64_t* head;             // Records written so far, kept in the file
+    uint32_t* status;           // trace_status_t, kept in the file
+    void* map;
+    size_t map_size;
+} trace_t;
+
+// Mutable state of one execution of a program
+typedef struct {
+    const program_t* program;
+    int64_t* values;            // Runtime values, indexed by slot
+    output_t output;
+    int error_line;             // Line of the runtime error ending the last run, -1 if none
+    profile_t* profile;         // Accumulated over runs by execute_profiled, else NULL
+    uint64_t executed;          // Instructions run by the last run of a counting engine
+    trace_t* trace;             // Ring buffer execute_traced records into, else NULL
+} context_t;
+
+// What a bytecode image was built from, kept in its header
+typedef struct {
+    uint64_t source_hash;
+    int opt_level;
+    int instruction_count;      // As parsed, labels included
+    int label_count;
+    optimize_stats_t stats;
+} image_info_t;
+
+// Execution engine entry point
+typedef int (*engine_fn)(context_t* context);
+
+// Native code from the JIT, run over a context's values
+typedef int (*jit_entry_fn)(int64_t* values, context_t* context);
+typedef struct {
+    void* memory;
+    size_t size;
+    jit_entry_fn entry;
+} jit_code_t;
+
+// How --batch runs its programs
+typedef struct {
+    int jobs;                   // Worker threads, 0 for one per online CPU
+    int opt_level;
+    engine_fn engine;
+} batch_options_t;
+
+// Writes output to stdout and errors to stderr
+extern const sink_t stdio_sink;
+
 // Function declarations
-void print_error(int line, const char* message, const char* detail);
-int tokenize_line(const char* line, int line_number, token_t tokens[], int* token_count);
-opcode_t string_to_opcode(const char* str);
-comparison_t string_to_comparison(const char* str);
+void arena_init(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_grow(arena_t* arena, void* ptr, size_t old_size, size_t new_size);
+void* arena_reserve(arena_t* arena, void* items, int needed, int* capacity, size_t item_size);
+void arena_free(arena_t* arena);
+int hash_index_reserve(arena_t* arena, hash_index_t* index, int needed);
+hash_entry_t* hash_index_probe(const hash_index_t* index, uint32_t hash);
+hash_entry_t* hash_index_next(const hash_index_t* index, const hash_entry_t* entry);
+void hash_index_insert(hash_index_t* index, hash_entry_t* entry, int item, uint32_t hash);
+void print_error(const sink_t* sink, int line, const char* message, const char* detail);
+void print_error_span(const sink_t* sink, int line, const char* message, span_t detail);
+int span_equals(span_t span, const char* str);
+int select_scanner(const char* name);
+const char* scanner_name(void);
+int scanner_init(scanner_t* scanner, const char* text, size_t size);
+size_t scan_window(scanner_t* scanner);
+void scanner_free(scanner_t* scanner);
+int lexer_init(lexer_t* lexer, const char* text, size_t size, const sink_t* sink);
+void lexer_free(lexer_t* lexer);
+int lexer_done(lexer_t* lexer);
+int tokenize_line(lexer_t* lexer, token_t tokens[], int* token_count);
+opcode_t string_to_opcode(span_t text);
+comparison_t string_to_comparison(span_t text);
+void init_program(program_t* program);
+int load_source(const char* filename, program_t* program);
+int load_program(const char* filename, program_t* program);
+int parse_source(program_t* program);
+int parse_source_jobs(program_t* program, int jobs);
+int parse_line(program_t* program, const token_t tokens[], int token_count, int line_number);
 int parse_program(const char* filename, program_t* program);
+void free_program(program_t* program);
 int validate_program(program_t* program);
-int execute_program(program_t* program);
-int64_t get_variable_value(program_t* program, const char* name);
-void set_variable_value(program_t* program, const char* name, int64_t value);
-int find_label(program_t* program, const char* name);
-int is_valid_identifier(const char* str);
-int64_t parse_integer(const char* str);
+int validate_instruction(program_t* program, instruction_t* inst);
+int lower_program(program_t* program);
+int constant_slot(program_t* program, int64_t value);
+void optimize_program(program_t* program, int level, optimize_stats_t* stats);
+uint64_t hash_source(const char* text, size_t size);
+int save_image(const program_t* program, const char* path, const image_info_t* info);
+int load_image(program_t* program, const char* path, const image_info_t* expected, image_info_t* info);
+char* image_path(const char* source, const char* cache_dir, const image_info_t* info);
+int emit_c(const program_t* program, const char* source_name, FILE* out);
+int run_batch(const char* const* files, int file_count, const char* manifest, const batch_options_t* options);
+int run_sweep(const program_t* program, const char* table_path);
+int run_stream(int fd, flush_policy_t policy, int quiet);
+flush_policy_t find_flush_policy(const char* name);
+flush_policy_t output_default_policy(void);
+void output_init(output_t* output, const sink_t* sink, flush_policy_t policy);
+void output_free(output_t* output);
+void output_integer(output_t* output, int64_t value);
+void output_string(output_t* output, const char* str, size_t length);
+void output_flush(output_t* output);
+int context_init(context_t* context, const program_t* program, const sink_t* sink);
+void context_free(context_t* context);
+void runtime_error(context_t* context, int line, const char* message);
+int execute_program(context_t* context);
+int execute_switch(context_t* context);
+int execute_threaded(context_t* context);
+int execute_jit(context_t* context);
+int execute_profiled(context_t* context);
+int execute_traced(context_t* context);
+void print_profile(const program_t* program, const profile_t* profile, FILE* out);
+const char** index_source(const program_t* program, int* line_count);
+span_t line_text(const char** starts, int line_count, int line);
+trace_t* trace_open(const char* path, const program_t* program, const char* source_name, uint32_t capacity);
+void trace_close(trace_t* trace);
+int dump_trace(const char* path, uint64_t limit, FILE* out);
+int write_profile_json(const program_t* program, const profile_t* profile, const char* source_name, FILE* out);
+int jit_compile(const compiled_t* compiled, jit_code_t* native);
+void jit_free(jit_code_t* native);
+engine_fn find_engine(const char* name);
+engine_fn counting_engine(engine_fn engine);
+int intern_symbol(program_t* program, span_t name);
+int find_label(program_t* program, span_t name);
+int index_label(program_t* program, int label);
+void build_cfg(program_t* program);
+int is_valid_identifier(span_t text);
+int is_text_operand(const instruction_t* inst);
+int64_t parse_integer(span_t text);
 
 #endif // BAREWORD_H
\ No newline at end of file
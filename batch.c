@@ -0,0 +1,399 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include "bareword.h"
+
+/*
+ * Batch runner (--batch). Every program is parsed, validated and executed
+ * on a pool of worker threads, each with its own program and context, so
+ * nothing is shared but the job table. Output and diagnostics are captured
+ * per job and written in input order by the main thread as soon as each
+ * job and all before it are done.
+ *
+ * Jobs are dealt out as one contiguous range per worker. A worker runs its
+ * range from the front; once it is empty, it steals the back half of
+ * another worker's remaining range.
+ */
+ 
+typedef enum {
+    JOB_OK,
+    JOB_IO,
+    JOB_SYNTAX,
+    JOB_VALIDATION,
+    JOB_RUNTIME,
+    JOB_MEMORY
+} job_status_t;
+
+static const char* const job_status_names[] = {
+    "ok", "cannot read source", "syntax error", "validation error", "runtime error", "out of memory"
+};
+
+// Growable byte buffer for captured text
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} capture_t;
+
+typedef struct {
+    const char* path;
+    capture_t output;
+    capture_t errors;
+    size_t source_size;
+    job_status_t status;
+    int done;                   // Guarded by batch_t.lock
+} job_t;
+
+// A worker's remaining jobs, [next, end)
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} queue_t;
+
+typedef struct {
+    job_t* jobs;
+    int job_count;
+    queue_t* queues;
+    int worker_count;
+    const batch_options_t* options;
+    pthread_mutex_t lock;       // Guards job completion
+    pthread_cond_t finished;
+} batch_t;
+
+typedef struct {
+    batch_t* batch;
+    int index;
+} worker_t;
+
+static void capture_append(capture_t* capture, const char* data, size_t size) {
+    if (capture->capacity - capture->size < size) {
+        size_t capacity = capture->capacity > 0 ? capture->capacity * 2 : 256;
+        while (capacity - capture->size < size) {
+            capacity *= 2;
+        }
+        char* grown = realloc(capture->data, capacity);
+        if (!grown) {
+            return; // Dropped, like output to a full disk
+        }
+        capture->data = grown;
+        capture->capacity = capacity;
+    }
+    memcpy(capture->data + capture->size, data, size);
+    capture->size += size;
+}
+
+static void capture_printf(capture_t* capture, const char* format, ...) {
+    char text[512];
+    va_list args;
+    
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length > 0) {
+        capture_append(capture, text, (size_t)length < sizeof(text) ? (size_t)length : sizeof(text) - 1);
+    }
+}
+
+static void job_write(void* user, const char* data, size_t size) {
+    capture_append(&((job_t*)user)->output, data, size);
+}
+
+// The same text the interpreter writes to stderr
+static void job_error(void* user, int line, const char* message, span_t detail) {
+    capture_t* errors = &((job_t*)user)->errors;
+    
+    if (detail.length > 0) {
+        capture_printf(errors, "Error at line %d: %s \"%.*s\"\n", line, message, detail.length, detail.start);
+    } else {
+        capture_printf(errors, "Error at line %d: %s\n", line, message);
+    }
+}
+
+static void run_job(job_t* job, const batch_options_t* options) {
+    sink_t sink = { job_write, job_error, job };
+    program_t program;
+    context_t context;
+    optimize_stats_t stats;
+    
+    init_program(&program);
+    program.sink = &sink;
+    
+    if (!load_source(job->path, &program)) {
+        capture_printf(&job->errors, "Error: cannot open file '%s'\n", job->path);
+        job->status = JOB_IO;
+    } else if (!parse_source_jobs(&program, 1)) {   // The pool already keeps every CPU busy
+        job->status = JOB_SYNTAX;
+    } else if (!validate_program(&program)) {
+        job->status = JOB_VALIDATION;
+    } else {
+        if (options->opt_level > 0) {
+            optimize_program(&program, options->opt_level, &stats);
+        }
+        
+        if (!context_init(&context, &program, &sink)) {
+            job->status = JOB_MEMORY;
+        } else {
+            // Everything stays in the context's buffer until the end
+            context.output.policy = FLUSH_EXIT;
+            job->status = options->engine(&context) ? JOB_OK : JOB_RUNTIME;
+            output_flush(&context.output);
+        }
+        context_free(&context);
+    }
+    
+    job->source_size = program.source_size;
+    free_program(&program);
+}
+
+// Next job for a worker: its own, or the back half of someone else's
+static int next_job(batch_t* batch, int self) {
+    queue_t* own = &batch->queues[self];
+    int job = -1;
+    
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end) {
+        job = own->next++;
+    }
+    pthread_mutex_unlock(&own->lock);
+    if (job != -1) {
+        return job;
+    }
+    
+    for (int i = 1; i < batch->worker_count; i++) {
+        queue_t* victim = &batch->queues[(self + i) % batch->worker_count];
+        int begin = 0;
+        int end = 0;
+        
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->next;
+        if (remaining > 0) {
+            begin = victim->end - (remaining + 1) / 2;
+            end = victim->end;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        
+        if (begin < end) {
+            pthread_mutex_lock(&own->lock);
+            own->next = begin + 1;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return begin;
+        }
+    }
+    return -1;
+}
+
+static void* worker_main(void* arg) {
+    worker_t* worker = arg;
+    batch_t* batch = worker->batch;
+    int index;
+    
+    while ((index = next_job(batch, worker->index)) != -1) {
+        run_job(&batch->jobs[index], batch->options);
+        
+        pthread_mutex_lock(&batch->lock);
+        batch->jobs[index].done = 1;
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    return NULL;
+}
+
+// Paths listed one per line; blank lines and # comments are skipped.
+// Returns the file contents the paths point into, NULL on failure.
+static char* read_manifest(const char* filename, const char*** paths, int* count, int* capacity) {
+    FILE* file = fopen(filename, "rb");
+    char* text = NULL;
+    size_t size = 0;
+    size_t text_capacity = 0;
+    size_t n;
+    
+    if (!file) {
+        return NULL;
+    }
+    do {
+        if (text_capacity - size < 4096) {
+            text_capacity = text_capacity > 0 ? text_capacity * 2 : 65536;
+            char* grown = realloc(text, text_capacity + 1);
+            if (!grown) {
+                free(text);
+                fclose(file);
+                return NULL;
+            }
+            text = grown;
+        }
+        n = fread(text + size, 1, text_capacity - size, file);
+        size += n;
+    } while (n > 0);
+    fclose(file);
+    text[size] = '\0';
+    
+    for (char* line = text; line < text + size;) {
+        char* end = strchr(line, '\n');
+        char* next = end ? end + 1 : text + size;
+        
+        if (!end) {
+            end = text + size;
+        }
+        while (line < end && isspace((unsigned char)*line)) line++;
+        while (end > line && isspace((unsigned char)end[-1])) end--;
+        *end = '\0';
+        
+        if (line < end && *line != '#') {
+            if (*count == *capacity) {
+                *capacity = *capacity > 0 ? *capacity * 2 : 1024;
+                const char** grown = realloc(*paths, sizeof(char*) * *capacity);
+                if (!grown) {
+                    free(text);
+                    return NULL;
+                }
+                *paths = grown;
+            }
+            (*paths)[(*count)++] = line;
+        }
+        line = next;
+    }
+    return text;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int run_batch(const char* const* files, int file_count, const char* manifest, const batch_options_t* options) {
+    const char** paths = NULL;
+    int count = 0;
+    int capacity = 0;
+    char* manifest_text = NULL;
+    
+    if (file_count > 0) {
+        capacity = file_count;
+        paths = malloc(sizeof(char*) * capacity);
+        if (!paths) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 1;
+        }
+        for (int i = 0; i < file_count; i++) {
+            paths[count++] = files[i];
+        }
+    }
+    if (manifest) {
+        manifest_text = read_manifest(manifest, &paths, &count, &capacity);
+        if (!manifest_text) {
+            fprintf(stderr, "Error: cannot read manifest '%s'\n", manifest);
+            free(paths);
+            return 1;
+        }
+    }
+    
+    batch_t batch;
+    batch.job_count = count;
+    batch.options = options;
+    batch.worker_count = options->jobs > 0 ? options->jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (batch.worker_count < 1) {
+        batch.worker_count = 1;
+    }
+    if (batch.worker_count > count && count > 0) {
+        batch.worker_count = count;
+    }
+    batch.jobs = calloc(count > 0 ? count : 1, sizeof(job_t));
+    batch.queues = malloc(sizeof(queue_t) * batch.worker_count);
+    pthread_t* threads = malloc(sizeof(pthread_t) * batch.worker_count);
+    worker_t* workers = malloc(sizeof(worker_t) * batch.worker_count);
+    
+    if (!batch.jobs || !batch.queues || !threads || !workers) {
+        fprintf(stderr, "Error: out of memory\n");
+        free(batch.jobs);
+        free(batch.queues);
+        free(threads);
+        free(workers);
+        free(manifest_text);
+        free(paths);
+        return 1;
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.finished, NULL);
+    
+    // One contiguous share per worker to start with
+    for (int i = 0; i < count; i++) {
+        batch.jobs[i].path = paths[i];
+    }
+    for (int i = 0; i < batch.worker_count; i++) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].next = (int)((int64_t)count * i / batch.worker_count);
+        batch.queues[i].end = (int)((int64_t)count * (i + 1) / batch.worker_count);
+    }
+    
+    double start = now();
+    int started = 0;
+    for (int i = 0; i < batch.worker_count; i++) {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        // No threads available: run everything here
+        worker_main(&workers[0]);
+    }
+    
+    // Results in input order, each as soon as it and all before it are done
+    int failed = 0;
+    size_t source_bytes = 0;
+    for (int i = 0; i < count; i++) {
+        job_t* job = &batch.jobs[i];
+        
+        pthread_mutex_lock(&batch.lock);
+        while (!job->done) {
+            pthread_cond_wait(&batch.finished, &batch.lock);
+        }
+        pthread_mutex_unlock(&batch.lock);
+        
+        printf("==> %s: %s\n", job->path, job_status_names[job->status]);
+        if (job->output.size > 0) {
+            fwrite(job->output.data, 1, job->output.size, stdout);
+        }
+        if (job->errors.size > 0) {
+            fflush(stdout);
+            fwrite(job->errors.data, 1, job->errors.size, stderr);
+        }
+        if (job->status != JOB_OK) {
+            failed++;
+        }
+        source_bytes += job->source_size;
+        free(job->output.data);
+        free(job->errors.data);
+    }
+    fflush(stdout);
+    
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+    
+    fprintf(stderr, "\nBatch: %d programs, %d ok, %d failed in %.3f s on %d threads "
+            "(%.0f programs/s, %.1f MB/s of source)\n",
+            count, count - failed, failed, elapsed, started > 0 ? started : 1,
+            elapsed > 0 ? count / elapsed : 0.0, elapsed > 0 ? source_bytes / elapsed / 1e6 : 0.0);
+            
+    for (int i = 0; i < batch.worker_count; i++) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.finished);
+    free(batch.jobs);
+    free(batch.queues);
+    free(threads);
+    free(workers);
+    free(manifest_text);
+    free(paths);
+    return failed > 0 ? 1 : 0;
+}
\ No newline at end of file
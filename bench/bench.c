@@ -0,0 +1,493 @@
+/*
+ * Phase benchmark. Generates parameterized workloads in memory and times
+ * lexing, parsing, validation, optimization and execution on each engine
+ * separately, each phase repeated and summarized as min, median, mean and
+ * standard deviation. Results can be written as CSV and JSON and compared
+ * against an earlier CSV, flagging every phase whose median got slower.
+ *
+ *   make bench
+ *   bench/bench [options] [workload...]
+ */
+ 
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+#include "bareword.h"
+
+#define MAX_RESULTS 128
+#define MAX_ENGINES 8
+
+typedef struct {
+    char* text;
+    size_t size;
+    size_t capacity;
+} source_t;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    void (*generate)(source_t* source, double scale);
+} workload_t;
+
+typedef struct {
+    char workload[32];
+    char phase[32];
+    size_t bytes;
+    double min;                 // Milliseconds
+    double median;
+    double mean;
+    double stddev;
+} result_t;
+
+typedef struct {
+    int repeats;
+    double scale;
+    int opt_level;
+    const char* engines[MAX_ENGINES];
+    int engine_count;
+    result_t results[MAX_RESULTS];
+    int result_count;
+} bench_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void append(source_t* source, const char* format, ...) {
+    va_list args;
+    
+    if (source->capacity - source->size < 256) {
+        size_t capacity = source->capacity > 0 ? source->capacity * 2 : 65536;
+        char* grown = realloc(source->text, capacity);
+        if (!grown) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+        source->text = grown;
+        source->capacity = capacity;
+    }
+    va_start(args, format);
+    source->size += vsnprintf(source->text + source->size, source->capacity - source->size, format, args);
+    va_end(args);
+}
+
+static long scaled(double base, double scale) {
+    long n = (long)(base * scale);
+    return n > 1 ? n : 1;
+}
+
+// Tight counting loop: four instructions per iteration, almost no source
+static void generate_loop(source_t* source, double scale) {
+    append(source, "set i 0\nset sum 0\nlabel loop\n");
+    append(source, "add sum sum i\nadd i i 1\n");
+    append(source, "cmp c i < %ld\nif c goto loop\n", scaled(20000000, scale));
+    append(source, "out sum\nhalt\n");
+}
+
+// Hundreds of variables, every one updated on every iteration
+static void generate_variables(source_t* source, double scale) {
+    int names = 400;
+    
+    for (int v = 0; v < names; v++) {
+        append(source, "set var_%d %d\n", v, v);
+    }
+    append(source, "set i 0\nlabel loop\n");
+    for (int v = 1; v < names; v++) {
+        append(source, "add var_%d var_%d var_%d\n", v, v, v - 1);
+    }
+    append(source, "add i i 1\ncmp c i < %ld\nif c goto loop\n", scaled(20000, scale));
+    append(source, "out var_%d\nhalt\n", names - 1);
+}
+
+// A long chain of compare-and-branch blocks, half of them taken
+static void generate_branches(source_t* source, double scale) {
+    int depth = 1000;
+    
+    append(source, "set i 0\nset hits 0\nlabel loop\n");
+    for (int d = 0; d < depth; d++) {
+        append(source, "cmp c i %s %d\nif c goto skip_%d\n", d % 2 ? "<" : ">=", d, d);
+        append(source, "add hits hits 1\nlabel skip_%d\n", d);
+    }
+    append(source, "add i i 1\ncmp c i < %ld\nif c goto loop\n", scaled(10000, scale));
+    append(source, "out hits\nhalt\n");
+}
+
+// Formatting and buffering: an integer and a string per iteration
+static void generate_output(source_t* source, double scale) {
+    append(source, "set i 0\nlabel loop\n");
+    append(source, "out i\nout \"line of program output\"\n");
+    append(source, "add i i 1\ncmp c i < %ld\nif c goto loop\n", scaled(2000000, scale));
+    append(source, "halt\n");
+}
+
+// Megabytes of straight-line code over thousands of variables, in blocks
+// of 10 lines each ending in a forward branch, run once
+static void generate_large(source_t* source, double scale) {
+    long lines = scaled(1000000, scale);
+    
+    for (long i = 0; i < lines; i++) {
+        long block = i / 10;
+        
+        switch (i % 10) {
+            case 7: append(source, "cmp c total >= %ld\n", i); break;
+            case 8: append(source, "if c goto block_%ld\n", block); break;
+            case 9: append(source, "label block_%ld\n", block); break;
+            default:
+                switch (i % 5) {
+                    case 0: append(source, "set v%ld %ld\n", i % 4096, i * 7); break;
+                    case 1: append(source, "add total total v%ld\n", (i - 1) % 4096); break;
+                    case 2: append(source, "mul scratch total 3\n"); break;
+                    case 3: append(source, "sub total total 1\n"); break;
+                    case 4: append(source, "\n"); break;
+                }
+        }
+    }
+    append(source, "out total\nhalt\n");
+}
+
+static const workload_t workloads[] = {
+    { "loop", "tight counting loop", generate_loop },
+    { "variables", "400 variables updated per iteration", generate_variables },
+    { "branches", "chain of 1000 compare-and-branch blocks", generate_branches },
+    { "output", "integer and string output per iteration", generate_output },
+    { "large", "megabytes of straight-line source", generate_large }
+};
+
+// Program output is formatted and buffered, then dropped
+static void discard_write(void* user, const char* data, size_t size) {
+    (void)user;
+    (void)data;
+    (void)size;
+}
+
+static void report_error(void* user, int line, const char* message, span_t detail) {
+    (void)user;
+    fprintf(stderr, "Error at line %d: %s %.*s\n", line, message, detail.length, detail.start ? detail.start : "");
+}
+
+static const sink_t bench_sink = { discard_write, report_error, NULL };
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Summarize samples given in seconds
+static void record(bench_t* bench, const char* workload, const char* phase, size_t bytes, double* samples, int n) {
+    if (bench->result_count == MAX_RESULTS) {
+        return;
+    }
+    result_t* result = &bench->results[bench->result_count++];
+    double sum = 0;
+    double squares = 0;
+    
+    qsort(samples, n, sizeof(double), compare_doubles);
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    double mean = sum / n;
+    for (int i = 0; i < n; i++) {
+        squares += (samples[i] - mean) * (samples[i] - mean);
+    }
+    
+    snprintf(result->workload, sizeof(result->workload), "%s", workload);
+    snprintf(result->phase, sizeof(result->phase), "%s", phase);
+    result->bytes = bytes;
+    result->min = samples[0] * 1e3;
+    result->median = (n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2) * 1e3;
+    result->mean = mean * 1e3;
+    result->stddev = (n > 1 ? sqrt(squares / (n - 1)) : 0) * 1e3;
+    
+    printf("%-10s %-18s %10.3f %10.3f %10.3f %9.3f", workload, phase, result->min, result->median, result->mean,
+           result->stddev);
+    if (bytes > 0) {
+        printf(" %9.1f", bytes / (result->median / 1e3) / 1e6);
+    }
+    printf("\n");
+}
+
+static double time_lex(const source_t* source) {
+    lexer_t lexer;
+    token_t tokens[MAX_TOKENS_PER_LINE];
+    int count;
+    double start = now();
+    
+    if (!lexer_init(&lexer, source->text, source->size, &bench_sink)) {
+        return 0;
+    }
+    while (!lexer_done(&lexer)) {
+        if (!tokenize_line(&lexer, tokens, &count)) {
+            break;
+        }
+    }
+    lexer_free(&lexer);
+    return now() - start;
+}
+
+static int run_workload(bench_t* bench, const workload_t* workload) {
+    source_t source = { NULL, 0, 0 };
+    int n = bench->repeats;
+    double* lex = malloc(sizeof(double) * n);
+    double* parse = malloc(sizeof(double) * n);
+    double* validate = malloc(sizeof(double) * n);
+    double* optimize = malloc(sizeof(double) * n);
+    double* execute = malloc(sizeof(double) * n * bench->engine_count);
+    int ok = 1;
+    
+    workload->generate(&source, bench->scale);
+    if (!lex || !parse || !validate || !optimize || !execute) {
+        fprintf(stderr, "Error: out of memory\n");
+        ok = 0;
+    }
+    
+    for (int r = 0; ok && r < n; r++) {
+        program_t program;
+        optimize_stats_t stats;
+        double start;
+        
+        lex[r] = time_lex(&source);
+        
+        // Every phase after lexing works on a fresh program over the same text
+        init_program(&program);
+        program.sink = &bench_sink;
+        program.source = source.text;
+        program.source_size = source.size;
+        
+        start = now();
+        ok = parse_source(&program);
+        parse[r] = now() - start;
+        
+        start = now();
+        ok = ok && validate_program(&program);
+        validate[r] = now() - start;
+        
+        start = now();
+        if (ok && bench->opt_level > 0) {
+            optimize_program(&program, bench->opt_level, &stats);
+        }
+        optimize[r] = now() - start;
+        
+        for (int e = 0; ok && e < bench->engine_count; e++) {
+            context_t context;
+            
+            if (!context_init(&context, &program, &bench_sink)) {
+                context_free(&context);
+                ok = 0;
+                break;
+            }
+            start = now();
+            ok = find_engine(bench->engines[e])(&context);
+            output_flush(&context.output);
+            execute[e * n + r] = now() - start;
+            context_free(&context);
+        }
+        free_program(&program);
+    }
+    
+    if (!ok) {
+        fprintf(stderr, "Error: workload '%s' failed\n", workload->name);
+    } else {
+        record(bench, workload->name, "lex", source.size, lex, n);
+        record(bench, workload->name, "parse", source.size, parse, n);
+        record(bench, workload->name, "validate", source.size, validate, n);
+        if (bench->opt_level > 0) {
+            record(bench, workload->name, "optimize", 0, optimize, n);
+        }
+        for (int e = 0; e < bench->engine_count; e++) {
+            char phase[32];
+            snprintf(phase, sizeof(phase), "execute-%s", bench->engines[e]);
+            record(bench, workload->name, phase, 0, &execute[e * n], n);
+        }
+    }
+    
+    free(lex);
+    free(parse);
+    free(validate);
+    free(optimize);
+    free(execute);
+    free(source.text);
+    return ok;
+}
+
+static int write_csv(const bench_t* bench, const char* path) {
+    FILE* file = fopen(path, "w");
+    
+    if (!file) {
+        return 0;
+    }
+    fprintf(file, "workload,phase,opt_level,repeats,source_bytes,min_ms,median_ms,mean_ms,stddev_ms\n");
+    for (int i = 0; i < bench->result_count; i++) {
+        const result_t* r = &bench->results[i];
+        fprintf(file, "%s,%s,%d,%d,%zu,%.4f,%.4f,%.4f,%.4f\n", r->workload, r->phase, bench->opt_level,
+                bench->repeats, r->bytes, r->min, r->median, r->mean, r->stddev);
+    }
+    return fclose(file) == 0;
+}
+
+static int write_json(const bench_t* bench, const char* path) {
+    FILE* file = fopen(path, "w");
+    
+    if (!file) {
+        return 0;
+    }
+    fprintf(file, "{\n  \"opt_level\": %d,\n  \"repeats\": %d,\n  \"scale\": %g,\n  \"results\": [",
+            bench->opt_level, bench->repeats, bench->scale);
+    for (int i = 0; i < bench->result_count; i++) {
+        const result_t* r = &bench->results[i];
+        fprintf(file, "%s\n    {\"workload\": \"%s\", \"phase\": \"%s\", \"source_bytes\": %zu, \"min_ms\": %.4f, "
+                "\"median_ms\": %.4f, \"mean_ms\": %.4f, \"stddev_ms\": %.4f}",
+                i > 0 ? "," : "", r->workload, r->phase, r->bytes, r->min, r->median, r->mean, r->stddev);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+// Compare medians with a CSV from an earlier run at the same level;
+// returns the number of phases more than threshold percent slower
+static int compare_baseline(const bench_t* bench, const char* path, double threshold) {
+    FILE* file = fopen(path, "r");
+    char line[512];
+    int regressions = 0;
+    
+    if (!file) {
+        fprintf(stderr, "Error: cannot read baseline '%s'\n", path);
+        return -1;
+    }
+    printf("\nCompared with %s:\n", path);
+    while (fgets(line, sizeof(line), file)) {
+        char workload[32];
+        char phase[32];
+        int opt_level;
+        double median;
+        
+        if (sscanf(line, "%31[^,],%31[^,],%d,%*d,%*u,%*f,%lf", workload, phase, &opt_level, &median) != 4 ||
+            opt_level != bench->opt_level) {
+            continue;
+        }
+        for (int i = 0; i < bench->result_count; i++) {
+            const result_t* r = &bench->results[i];
+            if (strcmp(r->workload, workload) != 0 || strcmp(r->phase, phase) != 0) {
+                continue;
+            }
+            
+            double change = median > 0 ? (r->median - median) / median * 100 : 0;
+            // Phases of a few microseconds are all noise
+            int regressed = change > threshold && r->median - median > 0.1;
+            printf("%-10s %-18s %10.3f -> %10.3f ms  %+7.1f%%%s\n", workload, phase, median, r->median, change,
+                   regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+static void print_usage(const char* name) {
+    printf("Usage: %s [options] [workload...]\n\n", name);
+    printf("Options:\n");
+    printf("  --repeat=N       Runs of every phase (default 5)\n");
+    printf("  --scale=X        Multiply workload sizes by X (default 1)\n");
+    printf("  -O0, -O1, -O2    Optimization level (default 0)\n");
+    printf("  --engine=NAME    Engine to time, may be repeated (default all)\n");
+    printf("  --csv=FILE       Write results as CSV\n");
+    printf("  --json=FILE      Write results as JSON\n");
+    printf("  --baseline=FILE  Compare with an earlier CSV, exit 1 on regressions\n");
+    printf("  --threshold=PCT  Slowdown that counts as a regression (default 10)\n\n");
+    printf("Workloads:\n");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        printf("  %-16s %s\n", workloads[i].name, workloads[i].description);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    static bench_t bench;
+    const char* selected[sizeof(workloads) / sizeof(workloads[0])];
+    int selected_count = 0;
+    const char* csv = NULL;
+    const char* json = NULL;
+    const char* baseline = NULL;
+    double threshold = 10;
+    
+    bench.repeats = 5;
+    bench.scale = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            bench.repeats = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--scale=", 8) == 0) {
+            bench.scale = atof(argv[i] + 8);
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0) {
+            bench.opt_level = argv[i][2] - '0';
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (!find_engine(argv[i] + 9)) {
+                fprintf(stderr, "Error: unknown engine '%s'\n", argv[i] + 9);
+                return 1;
+            }
+            if (bench.engine_count < MAX_ENGINES) {
+                bench.engines[bench.engine_count++] = argv[i] + 9;
+            }
+        } else if (strncmp(argv[i], "--csv=", 6) == 0) {
+            csv = argv[i] + 6;
+        } else if (strncmp(argv[i], "--json=", 7) == 0) {
+            json = argv[i] + 7;
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            baseline = argv[i] + 11;
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = atof(argv[i] + 12);
+        } else if (argv[i][0] != '-' && selected_count < (int)(sizeof(selected) / sizeof(selected[0]))) {
+            selected[selected_count++] = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < selected_count; i++) {
+        size_t w = 0;
+        while (w < sizeof(workloads) / sizeof(workloads[0]) && strcmp(selected[i], workloads[w].name) != 0) w++;
+        if (w == sizeof(workloads) / sizeof(workloads[0])) {
+            fprintf(stderr, "Error: unknown workload '%s'\n", selected[i]);
+            return 1;
+        }
+    }
+    if (bench.repeats < 1 || bench.scale <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (bench.engine_count == 0) {
+        bench.engines[bench.engine_count++] = "threaded";
+        bench.engines[bench.engine_count++] = "switch";
+        bench.engines[bench.engine_count++] = "jit";
+    }
+    
+    printf("%-10s %-18s %10s %10s %10s %9s %9s\n", "workload", "phase", "min ms", "median ms", "mean ms", "stddev",
+           "MB/s");
+    int failed = 0;
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        int wanted = selected_count == 0;
+        for (int i = 0; i < selected_count; i++) {
+            wanted |= strcmp(selected[i], workloads[w].name) == 0;
+        }
+        if (wanted && !run_workload(&bench, &workloads[w])) {
+            failed = 1;
+        }
+    }
+    
+    if (csv && !write_csv(&bench, csv)) {
+        fprintf(stderr, "Error: cannot write '%s'\n", csv);
+        failed = 1;
+    }
+    if (json && !write_json(&bench, json)) {
+        fprintf(stderr, "Error: cannot write '%s'\n", json);
+        failed = 1;
+    }
+    if (baseline) {
+        int regressions = compare_baseline(&bench, baseline, threshold);
+        if (regressions != 0) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+/*
+ * Lexer throughput benchmark. Times the structural scanner with each
+ * kernel the CPU supports, and full tokenization on top of it, over a
+ * generated program or the file given on the command line.
+ *
+ *   make lexer-bench
+ *   bench/lexer_bench [program.bw]
+ */
+ 
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "bareword.h"
+
+#define GENERATED_SIZE (64 * 1024 * 1024)
+#define REPEATS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A program shaped like our generated sources: short lines, a few strings
+static char* generate(size_t* size) {
+    char* text = malloc(GENERATED_SIZE + 256);
+    size_t used = 0;
+    int i = 0;
+    
+    if (!text) {
+        return NULL;
+    }
+    while (used < GENERATED_SIZE) {
+        switch (i % 6) {
+            case 0: used += sprintf(text + used, "set v%d %d\n", i, i * 7); break;
+            case 1: used += sprintf(text + used, "add total total v%d\n", i - 1); break;
+            case 2: used += sprintf(text + used, "cmp c total >= %d\n", i); break;
+            case 3: used += sprintf(text + used, "if c goto l%d\n", i); break;
+            case 4: used += sprintf(text + used, "out \"row %d done\"\n", i); break;
+            case 5: used += sprintf(text + used, "label l%d\n", i - 2); break;
+        }
+        i++;
+    }
+    *size = used;
+    return text;
+}
+
+static char* load(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    char* text;
+    
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    text = malloc(*size + 1);
+    if (text && fread(text, 1, *size, file) != *size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    return text;
+}
+
+// Best of REPEATS, in seconds
+static double time_scan(const char* text, size_t size) {
+    double best = 1e30;
+    
+    for (int r = 0; r < REPEATS; r++) {
+        scanner_t scanner;
+        double start = now();
+        
+        if (!scanner_init(&scanner, text, size)) {
+            return 0;
+        }
+        while (!scanner.finished) {
+            scan_window(&scanner);
+        }
+        scanner_free(&scanner);
+        
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+static double time_tokenize(const char* text, size_t size, size_t* tokens) {
+    double best = 1e30;
+    
+    for (int r = 0; r < REPEATS; r++) {
+        lexer_t lexer;
+        token_t line[MAX_TOKENS_PER_LINE];
+        int count;
+        double start = now();
+        
+        *tokens = 0;
+        if (!lexer_init(&lexer, text, size, &stdio_sink)) {
+            return 0;
+        }
+        while (!lexer_done(&lexer)) {
+            if (!tokenize_line(&lexer, line, &count)) {
+                break;
+            }
+            *tokens += count;
+        }
+        lexer_free(&lexer);
+        
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    static const char* kernels[] = { "scalar", "sse2", "avx2" };
+    size_t size;
+    char* text = argc > 1 ? load(argv[1], &size) : generate(&size);
+    
+    if (!text) {
+        fprintf(stderr, "Error: cannot load source\n");
+        return 1;
+    }
+    printf("source: %.1f MB\n", size / 1e6);
+    
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (!select_scanner(kernels[i])) {
+            printf("%-8s not supported\n", kernels[i]);
+            continue;
+        }
+        
+        size_t tokens;
+        double scan = time_scan(text, size);
+        double tokenize = time_tokenize(text, size, &tokens);
+        printf("%-8s scan %6.2f GB/s   tokenize %6.2f GB/s  (%zu tokens)\n",
+               kernels[i], size / scan / 1e9, size / tokenize / 1e9, tokens);
+    }
+    
+    free(text);
+    return 0;
+}
\ No newline at end of file
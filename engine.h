@@ -0,0 +1,296 @@
+/*
+ * Interpreter loop shared by every execution engine. executor.c includes
+ * this file once per engine after defining:
+ *
+ *   ENGINE_NAME      name of the function to define
+ *   ENGINE_THREADED  1 for computed-goto direct threading, 0 for a switch
+ *   ENGINE_COUNT     1 to count the instructions run into context->executed
+ *   ENGINE_PROFILE   1 to count executions, taken branches and clock ticks
+ *                    per instruction into context->profile
+ *   ENGINE_TRACE     1 to record every instruction into context->trace
+ *
+ * Instruction bodies are written once between TARGET() and NEXT()/JUMP(),
+ * so both dispatch strategies always agree on semantics.
+ */
+ 
+#if ENGINE_COUNT
+#define COUNT() (executed++)
+#else
+#define COUNT() ((void)0)
+#endif
+
+#if ENGINE_PROFILE
+
+// Every dispatch closes the interval of the instruction before it
+#define PROFILE_ENTER() do { \
+        uint64_t now = profile_clock(); \
+        profile->ticks[pc] += now - stamp; \
+        stamp = now; \
+        pc = (size_t)(ip - base); \
+        profile->counts[pc]++; \
+    } while (0)
+#define PROFILE_COUNT(index) (profile->counts[index]++)
+#define PROFILE_TAKEN(index) (profile->taken[index]++)
+
+#else
+
+#define PROFILE_ENTER() ((void)0)
+#define PROFILE_COUNT(index) ((void)0)
+#define PROFILE_TAKEN(index) ((void)0)
+
+#endif
+
+#if ENGINE_TRACE
+
+// Each record is started on entry to its instruction, where the opcode is a
+// constant, and given its value on entry to the next, after the store
+#define TRACE(op) do { \
+        record->value = *written; \
+        record = &trace->records[head & trace->mask]; \
+        *trace->head = ++head; \
+        record->pc = (uint32_t)(ip - base); \
+        record->slot = (op) < BC_OUT_R ? ip->dst : TRACE_NO_SLOT; \
+        written = (op) < BC_OUT_R ? &values[ip->dst] : &unwritten; \
+    } while (0)
+    
+#else
+
+#define TRACE(op) ((void)0)
+
+#endif
+
+#if ENGINE_THREADED
+
+#define TARGET(op) L_##op: COUNT(); TRACE(op);
+#define DISPATCH() do { PROFILE_ENTER(); goto *ip->handler; } while (0)
+#define NEXT() do { ip++; DISPATCH(); } while (0)
+#define JUMP(target) do { ip = &base[target]; DISPATCH(); } while (0)
+
+#else
+
+#define TARGET(op) case op: COUNT(); TRACE(op);
+#define NEXT() { ip++; continue; }
+#define JUMP(target) { ip = &base[target]; continue; }
+
+#endif
+
+#define LINE() (compiled->lines[ip - base])
+
+int ENGINE_NAME(context_t* context) {
+    const compiled_t* compiled = &context->program->compiled;
+    output_t* output = &context->output;
+    int64_t* values = context->values;
+    int result = 0;
+    
+    reset_values(context);
+    
+#if ENGINE_COUNT
+    uint64_t executed = 0;
+#endif
+#if ENGINE_PROFILE
+    if (!context->profile) {
+        context->profile = create_profile(compiled->count);
+        if (!context->profile) {
+            runtime_error(context, 0, "out of memory");
+            return 0;
+        }
+    }
+    profile_t* profile = context->profile;
+    size_t pc = compiled->count;    // Setup time goes to the unreported end slot
+    uint64_t stamp = profile_clock();
+#endif
+#if ENGINE_TRACE
+    trace_t* trace = context->trace;
+    uint64_t head = *trace->head;
+    const int64_t unwritten = 0;
+    trace_record_t first = { UINT32_MAX, TRACE_NO_SLOT, 0 };  // Completed before the first real record
+    trace_record_t* record = &first;
+    const int64_t* written = &unwritten;
+#endif
+
+#if ENGINE_THREADED
+#define ARITH_HANDLERS(name, op) [BC_##name##_RR] = &&L_BC_##name##_RR, [BC_##name##_RI] = &&L_BC_##name##_RI,
+#define COMPARE_HANDLERS(name, op) [BC_CMP_##name##_RR] = &&L_BC_CMP_##name##_RR, [BC_CMP_##name##_RI] = &&L_BC_CMP_##name##_RI,
+#define BRANCH_HANDLERS(name, op) [BC_BR_##name##_RR] = &&L_BC_BR_##name##_RR, [BC_BR_##name##_RI] = &&L_BC_BR_##name##_RI,
+    static void* const handlers[BC_COUNT] = {
+        [BC_SET_RR] = &&L_BC_SET_RR,
+        [BC_SET_RI] = &&L_BC_SET_RI,
+        ARITH_OPS(ARITH_HANDLERS)
+        [BC_DIV_RR] = &&L_BC_DIV_RR,
+        [BC_DIV_RI] = &&L_BC_DIV_RI,
+        COMPARE_OPS(COMPARE_HANDLERS)
+        COMPARE_OPS(BRANCH_HANDLERS)
+        [BC_OUT_R] = &&L_BC_OUT_R,
+        [BC_OUT_S] = &&L_BC_OUT_S,
+        [BC_IF] = &&L_BC_IF,
+        [BC_GOTO] = &&L_BC_GOTO,
+        [BC_HALT] = &&L_BC_HALT
+    };
+#undef ARITH_HANDLERS
+#undef COMPARE_HANDLERS
+#undef BRANCH_HANDLERS
+
+    // Translate to threaded code: each instruction carries its handler address
+    threaded_t* base = malloc(sizeof(threaded_t) * (compiled->count + 1));
+    if (!base) {
+        runtime_error(context, 0, "out of memory");
+        return 0;
+    }
+    for (int i = 0; i < compiled->count; i++) {
+        const bytecode_t* code = &compiled->code[i];
+        base[i].handler = code->op < BC_COUNT ? handlers[code->op] : &&L_UNKNOWN;
+        base[i].dst = code->dst;
+        base[i].a = code->a;
+        base[i].b = code->b;
+    }
+    base[compiled->count].handler = &&L_END; // Falling off the end
+    
+    const threaded_t* ip = base;
+    DISPATCH();
+#else
+    const bytecode_t* base = compiled->code;
+    const bytecode_t* end = base + compiled->count;
+    const bytecode_t* ip = base;
+    
+    while (ip < end) {
+        PROFILE_ENTER();
+        switch (ip->op) {
+#endif
+
+            TARGET(BC_SET_RR)
+                values[ip->dst] = values[ip->a];
+                NEXT();
+                
+            TARGET(BC_SET_RI)
+                values[ip->dst] = IMMEDIATE(ip->b);
+                NEXT();
+                
+#define ARITH_TARGETS(name, op) \
+            TARGET(BC_##name##_RR) \
+                values[ip->dst] = values[ip->a] op values[ip->b]; \
+                NEXT(); \
+            TARGET(BC_##name##_RI) \
+                values[ip->dst] = values[ip->a] op IMMEDIATE(ip->b); \
+                NEXT();
+            ARITH_OPS(ARITH_TARGETS)
+#undef ARITH_TARGETS
+
+            TARGET(BC_DIV_RR) {
+                int64_t b = values[ip->b];
+                
+                if (b == 0) {
+                    runtime_error(context, LINE(), "runtime error: division by zero");
+                    goto done;
+                }
+                
+                values[ip->dst] = values[ip->a] / b;
+                NEXT();
+            }
+            
+            TARGET(BC_DIV_RI)
+                values[ip->dst] = values[ip->a] / IMMEDIATE(ip->b);
+                NEXT();
+                
+#define COMPARE_TARGETS(name, op) \
+            TARGET(BC_CMP_##name##_RR) \
+                values[ip->dst] = values[ip->a] op values[ip->b]; \
+                NEXT(); \
+            TARGET(BC_CMP_##name##_RI) \
+                values[ip->dst] = values[ip->a] op IMMEDIATE(ip->b); \
+                NEXT();
+            COMPARE_OPS(COMPARE_TARGETS)
+#undef COMPARE_TARGETS
+
+            // Fused compare-and-branch, the following word holds the target
+#define BRANCH_TARGETS(name, op) \
+            TARGET(BC_BR_##name##_RR) { \
+                int64_t taken = values[ip->a] op values[ip->b]; \
+                values[ip->dst] = taken; \
+                PROFILE_COUNT(ip + 1 - base); \
+                if (taken) { PROFILE_TAKEN(ip + 1 - base); JUMP(ip[1].dst); } \
+                ip++; \
+                NEXT(); \
+            } \
+            TARGET(BC_BR_##name##_RI) { \
+                int64_t taken = values[ip->a] op IMMEDIATE(ip->b); \
+                values[ip->dst] = taken; \
+                PROFILE_COUNT(ip + 1 - base); \
+                if (taken) { PROFILE_TAKEN(ip + 1 - base); JUMP(ip[1].dst); } \
+                ip++; \
+                NEXT(); \
+            }
+            COMPARE_OPS(BRANCH_TARGETS)
+#undef BRANCH_TARGETS
+
+            TARGET(BC_OUT_R)
+                output_integer(output, values[ip->a]);
+                NEXT();
+                
+            TARGET(BC_OUT_S)
+                output_string(output, &compiled->strings[ip->a], ip->b);
+                NEXT();
+                
+            TARGET(BC_IF)
+                if (values[ip->a] != 0) {
+                    // Jump to the target resolved by the validator
+                    PROFILE_TAKEN(ip - base);
+                    JUMP(ip->dst);
+                }
+                NEXT();
+                
+            TARGET(BC_GOTO)
+                JUMP(ip->dst);
+                
+            TARGET(BC_HALT)
+                result = 1;
+                goto done;
+                
+#if ENGINE_THREADED
+    L_UNKNOWN:
+        runtime_error(context, LINE(), "unknown instruction");
+        goto done;
+        
+    L_END:
+#else
+            default:
+                runtime_error(context, LINE(), "unknown instruction");
+                goto done;
+        }
+    }
+#endif
+
+    // Program ended without halt
+    runtime_error(context, 0, "program ended without halt instruction");
+    
+done:
+#if ENGINE_COUNT
+    context->executed = executed;
+#endif
+#if ENGINE_PROFILE
+    profile->ticks[pc] += profile_clock() - stamp;
+#endif
+#if ENGINE_TRACE
+    // An instruction that failed stored nothing
+    if (!result && record->pc == (uint32_t)(ip - base)) {
+        record->slot = TRACE_NO_SLOT;
+    } else {
+        record->value = *written;
+    }
+    *trace->status = result ? TRACE_HALTED : TRACE_FAILED;
+#endif
+#if ENGINE_THREADED
+    free(base);
+#endif
+    return result;
+}
+
+#undef TARGET
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef LINE
+#undef COUNT
+#undef TRACE
+#undef PROFILE_ENTER
+#undef PROFILE_COUNT
+#undef PROFILE_TAKEN
\ No newline at end of file
@@ -1,184 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
 #include "bareword.h"
 
-int64_t get_variable_value(program_t* program, const char* name) {
-    for (int i = 0; i < program->variable_count; i++) {
-        if (strcmp(program->variables[i].name, name) == 0) {
-            return program->variables[i].value;
-        }
-    }
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define PROFILE_CLOCK "cycles"
+
+// The time-stamp counter, cheap enough to read on every dispatch
+static inline uint64_t profile_clock(void) {
+    return __rdtsc();
+}
+#else
+#define PROFILE_CLOCK "ns"
+
+static inline uint64_t profile_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+// Instruction with its handler address, for the direct-threaded engine
+typedef struct {
+    const void* handler;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+} threaded_t;
+
+int context_init(context_t* context, const program_t* program, const sink_t* sink) {
+    int slots = program->compiled.slot_count;
     
-    // Variable not found - create it with value 0
-    if (program->variable_count >= MAX_VARIABLES) {
-        fprintf(stderr, "Error: too many variables\n");
-        exit(1);
+    context->program = program;
+    context->values = calloc(slots > 0 ? slots : 1, sizeof(int64_t));
+    context->error_line = -1;
+    context->profile = NULL;
+    context->executed = 0;
+    context->trace = NULL;
+    output_init(&context->output, sink, FLUSH_FULL);
+    return context->values != NULL;
+}
+
+static void free_profile(profile_t* profile) {
+    if (profile) {
+        free(profile->counts);
+        free(profile->taken);
+        free(profile->ticks);
+        free(profile);
     }
+}
+
+// Counters for count instructions plus one slot for time outside them
+static profile_t* create_profile(int count) {
+    profile_t* profile = malloc(sizeof(profile_t));
     
-    variable_t* var = &program->variables[program->variable_count];
-    strncpy(var->name, name, MAX_TOKEN_LENGTH - 1);
-    var->name[MAX_TOKEN_LENGTH - 1] = '\0';
-    var->value = 0;
-    program->variable_count++;
+    if (!profile) {
+        return NULL;
+    }
+    profile->counts = calloc(count + 1, sizeof(uint64_t));
+    profile->taken = calloc(count + 1, sizeof(uint64_t));
+    profile->ticks = calloc(count + 1, sizeof(uint64_t));
+    profile->count = count;
+    profile->clock = PROFILE_CLOCK;
+    if (!profile->counts || !profile->taken || !profile->ticks) {
+        free_profile(profile);
+        return NULL;
+    }
+    return profile;
+}
+
+void context_free(context_t* context) {
+    free_profile(context->profile);
+    context->profile = NULL;
+    output_free(&context->output);
+    free(context->values);
+    context->values = NULL;
+}
+
+// Report an error that stops the run, after the output written so far
+void runtime_error(context_t* context, int line, const char* message) {
+    const sink_t* sink = context->output.sink;
+    span_t none = { NULL, 0 };
     
-    return 0;
+    output_flush(&context->output);
+    sink->error(sink->user, line, message, none);
+    context->error_line = line;
 }
 
-void set_variable_value(program_t* program, const char* name, int64_t value) {
+static void reset_values(context_t* context) {
+    const program_t* program = context->program;
+    const compiled_t* compiled = &program->compiled;
+    
+    // Variables start at zero, constants hold their literal
     for (int i = 0; i < program->variable_count; i++) {
-        if (strcmp(program->variables[i].name, name) == 0) {
-            program->variables[i].value = value;
-            return;
-        }
+        context->values[i] = 0;
+    }
+    for (int i = 0; i < compiled->constant_count; i++) {
+        context->values[program->variable_count + i] = compiled->constants[i];
     }
+    context->error_line = -1;
+}
+
+#define ENGINE_NAME execute_switch
+#define ENGINE_THREADED 0
+#define ENGINE_COUNT 0
+#define ENGINE_PROFILE 0
+#define ENGINE_TRACE 0
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_COUNT
+
+// Twins that also count instructions, for --stats
+static int execute_switch_counted(context_t* context);
+#define ENGINE_NAME execute_switch_counted
+#define ENGINE_COUNT 1
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_THREADED
+#undef ENGINE_COUNT
+#undef ENGINE_PROFILE
+#undef ENGINE_TRACE
+
+#if defined(__GNUC__)
+// Labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define ENGINE_NAME execute_threaded
+#define ENGINE_THREADED 1
+#define ENGINE_COUNT 0
+#define ENGINE_PROFILE 0
+#define ENGINE_TRACE 0
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_COUNT
+
+static int execute_threaded_counted(context_t* context);
+#define ENGINE_NAME execute_threaded_counted
+#define ENGINE_COUNT 1
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_PROFILE
+
+// The same loop with counters, so no other engine pays for them
+#define ENGINE_NAME execute_profiled
+#define ENGINE_PROFILE 1
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_COUNT
+#undef ENGINE_PROFILE
+#undef ENGINE_TRACE
+
+// And with the trace ring buffer
+#define ENGINE_NAME execute_traced
+#define ENGINE_COUNT 0
+#define ENGINE_PROFILE 0
+#define ENGINE_TRACE 1
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_THREADED
+#undef ENGINE_COUNT
+#undef ENGINE_PROFILE
+#undef ENGINE_TRACE
+#pragma GCC diagnostic pop
+#else
+// Portable fallback where computed goto is unavailable
+int execute_threaded(context_t* context) {
+    return execute_switch(context);
+}
+
+static int execute_threaded_counted(context_t* context) {
+    return execute_switch_counted(context);
+}
+
+#define ENGINE_NAME execute_profiled
+#define ENGINE_THREADED 0
+#define ENGINE_COUNT 1
+#define ENGINE_PROFILE 1
+#define ENGINE_TRACE 0
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_COUNT
+#undef ENGINE_PROFILE
+#undef ENGINE_TRACE
+
+#define ENGINE_NAME execute_traced
+#define ENGINE_COUNT 0
+#define ENGINE_PROFILE 0
+#define ENGINE_TRACE 1
+#include "engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_THREADED
+#undef ENGINE_COUNT
+#undef ENGINE_PROFILE
+#undef ENGINE_TRACE
+#endif
+
+// Native code where the JIT supports the platform, the interpreter elsewhere
+int execute_jit(context_t* context) {
+    jit_code_t native;
     
-    // Variable not found - create it
-    if (program->variable_count >= MAX_VARIABLES) {
-        fprintf(stderr, "Error: too many variables\n");
-        exit(1);
+    if (!jit_compile(&context->program->compiled, &native)) {
+        return execute_threaded(context);
     }
     
-    variable_t* var = &program->variables[program->variable_count];
-    strncpy(var->name, name, MAX_TOKEN_LENGTH - 1);
-    var->name[MAX_TOKEN_LENGTH - 1] = '\0';
-    var->value = value;
-    program->variable_count++;
+    reset_values(context);
+    int result = native.entry(context->values, context);
+    jit_free(&native);
+    return result;
 }
 
-int64_t resolve_value(program_t* program, const char* arg) {
-    // Check if it's a literal integer
-    if (isdigit(arg[0]) || (arg[0] == '-' && isdigit(arg[1]))) {
-        return parse_integer(arg);
+static const struct {
+    const char* name;
+    engine_fn run;
+    engine_fn counted;          // Same engine counting instructions, if any
+} engines[] = {
+    { "threaded", execute_threaded, execute_threaded_counted },
+    { "switch", execute_switch, execute_switch_counted },
+    { "jit", execute_jit, NULL }
+};
+
+engine_fn find_engine(const char* name) {
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i].name, name) == 0) {
+            return engines[i].run;
+        }
     }
-    
-    // Otherwise it's a variable
-    return get_variable_value(program, arg);
+    return NULL;
 }
 
-int execute_program(program_t* program) {
-    int pc = 0; // Program counter
-    
-    while (pc < program->instruction_count) {
-        instruction_t* inst = &program->instructions[pc];
-        
-        switch (inst->op) {
-            case OP_SET: {
-                int64_t value = resolve_value(program, inst->args[1]);
-                set_variable_value(program, inst->args[0], value);
-                break;
-            }
-            
-            case OP_OUT: {
-                // Check if argument looks like it should be a string (contains spaces or non-identifier chars)
-                char* arg = inst->args[0];
-                
-                // If it's clearly a string (has spaces) or starts with quote, treat as string
-                if (strchr(arg, ' ') || arg[0] == '"' || (!isdigit(arg[0]) && !is_valid_identifier(arg))) {
-                    printf("%s\n", arg);
-                } else {
-                    // Print variable or integer value
-                    int64_t value = resolve_value(program, inst->args[0]);
-                    printf("%lld\n", (long long)value);
-                }
-                break;
-            }
-            
-            case OP_ADD: {
-                int64_t a = resolve_value(program, inst->args[1]);
-                int64_t b = resolve_value(program, inst->args[2]);
-                set_variable_value(program, inst->args[0], a + b);
-                break;
-            }
-            
-            case OP_SUB: {
-                int64_t a = resolve_value(program, inst->args[1]);
-                int64_t b = resolve_value(program, inst->args[2]);
-                set_variable_value(program, inst->args[0], a - b);
-                break;
-            }
-            
-            case OP_MUL: {
-                int64_t a = resolve_value(program, inst->args[1]);
-                int64_t b = resolve_value(program, inst->args[2]);
-                set_variable_value(program, inst->args[0], a * b);
-                break;
-            }
-            
-            case OP_DIV: {
-                int64_t a = resolve_value(program, inst->args[1]);
-                int64_t b = resolve_value(program, inst->args[2]);
-                
-                if (b == 0) {
-                    print_error(inst->line_number, "runtime error: division by zero", "");
-                    return 0;
-                }
-                
-                set_variable_value(program, inst->args[0], a / b);
-                break;
-            }
-            
-            case OP_CMP: {
-                int64_t a = resolve_value(program, inst->args[1]);
-                int64_t b = resolve_value(program, inst->args[3]);
-                comparison_t op = string_to_comparison(inst->args[2]);
-                
-                int64_t result = 0;
-                switch (op) {
-                    case CMP_EQ: result = (a == b); break;
-                    case CMP_NE: result = (a != b); break;
-                    case CMP_LT: result = (a < b); break;
-                    case CMP_LE: result = (a <= b); break;
-                    case CMP_GT: result = (a > b); break;
-                    case CMP_GE: result = (a >= b); break;
-                    default:
-                        print_error(inst->line_number, "invalid comparison operator", inst->args[2]);
-                        return 0;
-                }
-                
-                set_variable_value(program, inst->args[0], result);
-                break;
-            }
-            
-            case OP_IF: {
-                int64_t condition = get_variable_value(program, inst->args[0]);
-                
-                if (condition != 0) {
-                    // Jump to label
-                    int target = find_label(program, inst->args[2]);
-                    if (target == -1) {
-                        print_error(inst->line_number, "undefined label", inst->args[2]);
-                        return 0;
-                    }
-                    pc = target;
-                    continue;
-                }
-                break;
-            }
-            
-            case OP_GOTO: {
-                int target = find_label(program, inst->args[0]);
-                if (target == -1) {
-                    print_error(inst->line_number, "undefined label", inst->args[0]);
-                    return 0;
-                }
-                pc = target;
-                continue;
-            }
-            
-            case OP_LABEL:
-                // Labels are no-ops during execution
-                break;
-                
-            case OP_HALT:
-                return 1;
-                
-            default:
-                print_error(inst->line_number, "unknown instruction", "");
-                return 0;
+// The variant of engine that sets context->executed, NULL if there is none
+engine_fn counting_engine(engine_fn engine) {
+    if (engine == execute_program) {
+        engine = execute_threaded;
+    }
+    if (engine == execute_profiled) {
+        return engine;
+    }
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (engines[i].run == engine || engines[i].counted == engine) {
+            return engines[i].counted;
         }
-        
-        pc++;
     }
-    
-    // Program ended without halt
-    print_error(0, "program ended without halt instruction", "");
-    return 0;
+    return NULL;
+}
+
+int execute_program(context_t* context) {
+    return execute_threaded(context);
 }
\ No newline at end of file
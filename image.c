@@ -0,0 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bareword.h"
+
+/*
+ * Bytecode images (.bwc). An image is the lowered program exactly as the
+ * executor reads it: a fixed header followed by the code, line, constant
+ * and string sections at aligned offsets. Nothing in it is a pointer, so a
+ * mapped image runs in place with no copying or fix-ups, and processes
+ * mapping the same file share its pages.
+ *
+ * Images are only valid for the producing build's byte order and layout;
+ * bump IMAGE_VERSION whenever bytecode_t, the opcode numbering or this
+ * header changes.
+ */
+
+#define IMAGE_MAGIC "BWC"
+#define IMAGE_VERSION 2
+#define IMAGE_BYTE_ORDER 0x01020304u
+#define IMAGE_ALIGN 16
+
+#define ALIGN_UP(n) (((n) + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1))
+
+typedef struct {
+    char magic[4];              // IMAGE_MAGIC, NUL-terminated
+    uint32_t version;           // IMAGE_VERSION
+    uint32_t byte_order;        // IMAGE_BYTE_ORDER as stored by the producer
+    uint32_t header_size;       // sizeof(image_header_t)
+    uint64_t source_hash;       // hash_source() of the program text
+    int32_t opt_level;
+    int32_t instruction_count;  // As parsed, labels included
+    int32_t label_count;
+    int32_t variable_count;
+    int32_t slot_count;
+    int32_t code_count;
+    int32_t constant_count;
+    int32_t string_size;
+    optimize_stats_t stats;
+    uint64_t code_offset;       // Section offsets from the start of the image
+    uint64_t lines_offset;
+    uint64_t constants_offset;
+    uint64_t strings_offset;
+    uint64_t image_size;
+} image_header_t;
+
+// 64-bit FNV-1a
+uint64_t hash_source(const char* text, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int write_section(FILE* file, uint64_t* position, uint64_t offset, const void* data, size_t size) {
+    static const char padding[IMAGE_ALIGN];
+    
+    if (fwrite(padding, 1, offset - *position, file) != offset - *position ||
+        (size > 0 && fwrite(data, 1, size, file) != size)) {
+        return 0;
+    }
+    *position = offset + size;
+    return 1;
+}
+
+int save_image(const program_t* program, const char* path, const image_info_t* info) {
+    const compiled_t* compiled = &program->compiled;
+    image_header_t header;
+    uint64_t position = 0;
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.header_size = sizeof(header);
+    header.source_hash = info->source_hash;
+    header.opt_level = info->opt_level;
+    header.instruction_count = info->instruction_count;
+    header.label_count = info->label_count;
+    header.variable_count = program->variable_count;
+    header.slot_count = compiled->slot_count;
+    header.code_count = compiled->count;
+    header.constant_count = compiled->constant_count;
+    header.string_size = compiled->string_size;
+    header.stats = info->stats;
+    header.code_offset = ALIGN_UP(sizeof(header));
+    header.lines_offset = ALIGN_UP(header.code_offset + sizeof(bytecode_t) * compiled->count);
+    header.constants_offset = ALIGN_UP(header.lines_offset + sizeof(int) * compiled->count);
+    header.strings_offset = ALIGN_UP(header.constants_offset + sizeof(int64_t) * compiled->constant_count);
+    header.image_size = header.strings_offset + compiled->string_size;
+    
+    // Write a private file and rename it into place, so concurrent runs
+    // only ever map complete images
+    char* temporary = malloc(strlen(path) + 32);
+    if (!temporary) {
+        return 0;
+    }
+    sprintf(temporary, "%s.%ld.tmp", path, (long)getpid());
+    
+    FILE* file = fopen(temporary, "wb");
+    if (!file) {
+        free(temporary);
+        return 0;
+    }
+    
+    int ok = write_section(file, &position, 0, &header, sizeof(header)) &&
+             write_section(file, &position, header.code_offset, compiled->code, sizeof(bytecode_t) * compiled->count) &&
+             write_section(file, &position, header.lines_offset, compiled->lines, sizeof(int) * compiled->count) &&
+             write_section(file, &position, header.constants_offset, compiled->constants,
+                           sizeof(int64_t) * compiled->constant_count) &&
+             write_section(file, &position, header.strings_offset, compiled->strings, compiled->string_size);
+             
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+    if (ok && rename(temporary, path) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        remove(temporary);
+    }
+    free(temporary);
+    return ok;
+}
+
+static int check_header(const image_header_t* header, uint64_t size) {
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header->version != IMAGE_VERSION || header->byte_order != IMAGE_BYTE_ORDER ||
+        header->header_size != sizeof(image_header_t) || header->image_size != size) {
+        return 0;
+    }
+    if (header->code_count < 0 || header->constant_count < 0 || header->string_size < 0 ||
+        header->variable_count < 0 ||
+        (int64_t)header->variable_count + header->constant_count > header->slot_count) {
+        return 0;
+    }
+    
+    // Every section must be aligned and lie inside the file
+    return header->code_offset % IMAGE_ALIGN == 0 && header->lines_offset % IMAGE_ALIGN == 0 &&
+           header->constants_offset % IMAGE_ALIGN == 0 &&
+           header->code_offset >= sizeof(image_header_t) &&
+           header->code_offset + sizeof(bytecode_t) * (uint64_t)header->code_count <= header->lines_offset &&
+           header->lines_offset + sizeof(int) * (uint64_t)header->code_count <= header->constants_offset &&
+           header->constants_offset + sizeof(int64_t) * (uint64_t)header->constant_count <= header->strings_offset &&
+           header->strings_offset + header->string_size <= size;
+}
+
+// Operands must stay inside the slots, strings and code, as lowering
+// guarantees for freshly compiled programs
+static int verify_code(const compiled_t* compiled) {
+    uint32_t slots = compiled->slot_count;
+    uint32_t count = compiled->count;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const bytecode_t* code = &compiled->code[i];
+        int op = code->op;
+        
+        if (op >= BC_COUNT) {
+            return 0;
+        }
+        if (op <= BC_BR_GE_RI) {
+            // Value operations: _RI forms have an immediate instead of b
+            int immediate = op % 2 == 1;
+            if (code->dst >= slots || (op != BC_SET_RI && code->a >= slots) ||
+                (!immediate && code->b >= slots) || (op == BC_DIV_RI && code->b == 0)) {
+                return 0;
+            }
+            if (op >= BC_BR_EQ_RR && (i + 1 >= count || compiled->code[i + 1].dst > count)) {
+                return 0;
+            }
+        }
+        
+        switch (op) {
+            case BC_OUT_R:
+                if (code->a >= slots) return 0;
+                break;
+            case BC_OUT_S:
+                if ((uint64_t)code->a + code->b >= (uint64_t)compiled->string_size ||
+                    compiled->strings[code->a + code->b] != '\0') {
+                    return 0;
+                }
+                break;
+            case BC_IF:
+                if (code->a >= slots || code->dst > count) return 0;
+                break;
+            case BC_GOTO:
+                if (code->dst > count) return 0;
+                break;
+            default:
+                break;
+        }
+    }
+    return 1;
+}
+
+int load_image(program_t* program, const char* path, const image_info_t* expected, image_info_t* info) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size < sizeof(image_header_t)) {
+        close(fd);
+        return 0;
+    }
+    
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    
+    const image_header_t* header = data;
+    if (!check_header(header, st.st_size) ||
+        (expected && (header->source_hash != expected->source_hash || header->opt_level != expected->opt_level))) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+    
+    // Point straight into the mapping; the executor never writes the code
+    compiled_t* compiled = &program->compiled;
+    memset(compiled, 0, sizeof(*compiled));
+    compiled->code = (bytecode_t*)((char*)data + header->code_offset);
+    compiled->lines = (int*)((char*)data + header->lines_offset);
+    compiled->count = header->code_count;
+    compiled->constants = (int64_t*)((char*)data + header->constants_offset);
+    compiled->constant_count = header->constant_count;
+    compiled->constant_capacity = header->constant_count;
+    compiled->strings = (char*)data + header->strings_offset;
+    compiled->string_size = header->string_size;
+    compiled->string_capacity = header->string_size;
+    compiled->slot_count = header->slot_count;
+    
+    if (!verify_code(compiled)) {
+        memset(compiled, 0, sizeof(*compiled));
+        munmap(data, st.st_size);
+        return 0;
+    }
+    
+    program->image = data;
+    program->image_size = st.st_size;
+    program->variable_count = header->variable_count;
+    
+    info->source_hash = header->source_hash;
+    info->opt_level = header->opt_level;
+    info->instruction_count = header->instruction_count;
+    info->label_count = header->label_count;
+    info->stats = header->stats;
+    return 1;
+}
+
+// The image for a source: beside it (prog.bw -> prog.bwc), or in a cache
+// directory under a name derived from the content and level, so identical
+// scripts share one image. The caller frees the result.
+char* image_path(const char* source, const char* cache_dir, const image_info_t* info) {
+    char* path;
+    
+    if (cache_dir) {
+        mkdir(cache_dir, 0777); // Usually exists already
+        path = malloc(strlen(cache_dir) + 32);
+        if (path) {
+            sprintf(path, "%s/%016llx-O%d.bwc", cache_dir, (unsigned long long)info->source_hash, info->opt_level);
+        }
+    } else {
+        const char* ext = strrchr(source, '.');
+        int stem = ext && strcmp(ext, ".bw") == 0 ? (int)(ext - source) : (int)strlen(source);
+        
+        path = malloc(stem + 5);
+        if (path) {
+            sprintf(path, "%.*s.bwc", stem, source);
+        }
+    }
+    return path;
+}
\ No newline at end of file
@@ -0,0 +1,437 @@
+#if defined(__x86_64__) && defined(__GNUC__) && (defined(__unix__) || defined(__APPLE__))
+#define _DEFAULT_SOURCE     // MAP_ANONYMOUS
+#include <stddef.h>
+#include <sys/mman.h>
+#define JIT_X86_64 1
+#else
+#define JIT_X86_64 0
+#endif
+#include "bareword.h"
+
+/*
+ * x86-64 JIT. The lowered code is translated one instruction at a time into
+ * native code that works on the values array in place: rbx holds its base
+ * and every slot is a [rbx + slot*8] operand. Branches become native jumps,
+ * resolved once every instruction's address is known. out and the division
+ * by zero error call back into the runtime with the context kept in r12.
+ *
+ * The generated function follows the System V calling convention, taking
+ * the values array and the context and returning 1 on halt or 0 after an
+ * error, like the interpreter engines. Elsewhere jit_compile() always
+ * fails and the executor interprets instead.
+ */
+
+#if JIT_X86_64
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7 };
+
+#define OUTPUT_OFFSET ((uint32_t)offsetof(context_t, output))
+
+// Condition codes in comparison_t order, for setcc (0F 90+cc) and jcc (0F 80+cc)
+static const uint8_t condition_codes[] = { 0x4, 0x5, 0xC, 0xE, 0xF, 0xD };
+
+// A rel32 jump field waiting for its target's address
+typedef struct {
+    size_t at;
+    int target;
+} fixup_t;
+
+typedef struct {
+    uint8_t* code;
+    size_t size;
+    fixup_t* fixups;
+    int fixup_count;
+    int cached;         // Slot whose value rax currently holds, or -1
+} jit_t;
+
+// Worst case bytes per instruction, the division check being the largest
+#define JIT_MAX_INSTRUCTION 64
+
+static void emit8(jit_t* jit, uint8_t byte) {
+    jit->code[jit->size++] = byte;
+}
+
+static void emit32(jit_t* jit, uint32_t value) {
+    memcpy(jit->code + jit->size, &value, 4);
+    jit->size += 4;
+}
+
+static void emit64(jit_t* jit, uint64_t value) {
+    memcpy(jit->code + jit->size, &value, 8);
+    jit->size += 8;
+}
+
+// REX.W opcode reg, [rbx + slot*8]; two-byte opcodes are passed as 0x0Fxx
+static void emit_slot(jit_t* jit, int opcode, int reg, uint32_t slot) {
+    uint32_t offset = slot * 8;
+    
+    emit8(jit, 0x48);
+    if (opcode > 0xFF) {
+        emit8(jit, 0x0F);
+    }
+    emit8(jit, opcode & 0xFF);
+    if (offset < 0x80) {
+        emit8(jit, 0x40 | reg << 3 | RBX);
+        emit8(jit, offset);
+    } else {
+        emit8(jit, 0x80 | reg << 3 | RBX);
+        emit32(jit, offset);
+    }
+}
+
+static void load_rax(jit_t* jit, uint32_t slot) {
+    if (jit->cached != (int)slot) {
+        emit_slot(jit, 0x8B, RAX, slot);
+        jit->cached = slot;
+    }
+}
+
+static void store_rax(jit_t* jit, uint32_t slot) {
+    emit_slot(jit, 0x89, RAX, slot);
+    jit->cached = slot;
+}
+
+// mov rax, function; call rax
+static void emit_call(jit_t* jit, uint64_t function) {
+    emit8(jit, 0x48);
+    emit8(jit, 0xB8);
+    emit64(jit, function);
+    emit8(jit, 0xFF);
+    emit8(jit, 0xD0);
+    jit->cached = -1;
+}
+
+// Jump to an instruction index, its rel32 patched once addresses are known
+static void emit_jump(jit_t* jit, int opcode, int target) {
+    if (opcode > 0xFF) {
+        emit8(jit, 0x0F);
+    }
+    emit8(jit, opcode & 0xFF);
+    jit->fixups[jit->fixup_count].at = jit->size;
+    jit->fixups[jit->fixup_count].target = target;
+    jit->fixup_count++;
+    emit32(jit, 0);
+}
+
+// rax = a op b, or flags from comparing a and b; _RI forms are the odd opcodes
+static void emit_operation(jit_t* jit, const bytecode_t* code, int rr_op) {
+    int immediate = code->op % 2 == 1;
+    
+    load_rax(jit, code->a);
+    switch (rr_op) {
+        case BC_ADD_RR:
+        case BC_SUB_RR:
+            if (immediate) {
+                emit8(jit, 0x48);
+                emit8(jit, 0x81);
+                emit8(jit, rr_op == BC_ADD_RR ? 0xC0 : 0xE8);
+                emit32(jit, code->b);
+            } else {
+                emit_slot(jit, rr_op == BC_ADD_RR ? 0x03 : 0x2B, RAX, code->b);
+            }
+            break;
+            
+        case BC_MUL_RR:
+            if (immediate) {
+                emit8(jit, 0x48);
+                emit8(jit, 0x69);
+                emit8(jit, 0xC0);
+                emit32(jit, code->b);
+            } else {
+                emit_slot(jit, 0x0FAF, RAX, code->b);
+            }
+            break;
+            
+        default: // cmp
+            if (immediate) {
+                emit8(jit, 0x48);
+                emit8(jit, 0x81);
+                emit8(jit, 0xF8);
+                emit32(jit, code->b);
+            } else {
+                emit_slot(jit, 0x3B, RAX, code->b);
+            }
+            break;
+    }
+    jit->cached = -1;
+}
+
+// rax = condition flag as 0 or 1, stored to dst
+static void emit_setcc(jit_t* jit, int condition, uint32_t dst) {
+    emit8(jit, 0x0F);
+    emit8(jit, 0x90 | condition);
+    emit8(jit, 0xC0);
+    emit8(jit, 0x0F);   // movzx eax, al
+    emit8(jit, 0xB6);
+    emit8(jit, 0xC0);
+    store_rax(jit, dst);
+}
+
+static void emit_if(jit_t* jit, const bytecode_t* code) {
+    emit_slot(jit, 0x83, 7, code->a);   // cmp qword [a], 0
+    emit8(jit, 0);
+    emit_jump(jit, 0x0F85, code->dst);
+}
+
+// mov rdi, r12: the context as first argument
+static void emit_context(jit_t* jit) {
+    emit8(jit, 0x4C);
+    emit8(jit, 0x89);
+    emit8(jit, 0xE7);
+}
+
+// lea rdi, [r12 + offset]: the context's output as first argument
+static void emit_output(jit_t* jit) {
+    emit8(jit, 0x49);
+    emit8(jit, 0x8D);
+    emit8(jit, 0xBC);
+    emit8(jit, 0x24);
+    emit32(jit, OUTPUT_OFFSET);
+}
+
+static void division_by_zero(context_t* context, int line) {
+    runtime_error(context, line, "runtime error: division by zero");
+}
+
+static void no_halt(context_t* context) {
+    runtime_error(context, 0, "program ended without halt instruction");
+}
+
+static void emit_divide(jit_t* jit, const bytecode_t* code, int line, int epilogue) {
+    if (code->op == BC_DIV_RR) {
+        int cached = jit->cached;
+        
+        emit_slot(jit, 0x8B, RCX, code->b);
+        emit8(jit, 0x48);   // test rcx, rcx
+        emit8(jit, 0x85);
+        emit8(jit, 0xC9);
+        emit8(jit, 0x75);   // jnz over the 27-byte error path
+        emit8(jit, 27);
+        emit_context(jit);
+        emit8(jit, 0xBE);   // mov esi, line
+        emit32(jit, line);
+        emit_call(jit, (uint64_t)(uintptr_t)division_by_zero);
+        emit8(jit, 0x31);   // xor eax, eax
+        emit8(jit, 0xC0);
+        emit_jump(jit, 0xE9, epilogue);
+        jit->cached = cached; // The error path never falls through
+    } else {
+        emit8(jit, 0x48);   // mov rcx, imm32
+        emit8(jit, 0xC7);
+        emit8(jit, 0xC1);
+        emit32(jit, code->b);
+    }
+    load_rax(jit, code->a);
+    emit8(jit, 0x48);   // cqo
+    emit8(jit, 0x99);
+    emit8(jit, 0x48);   // idiv rcx
+    emit8(jit, 0xF7);
+    emit8(jit, 0xF9);
+    store_rax(jit, code->dst);
+}
+
+int jit_compile(const compiled_t* compiled, jit_code_t* native) {
+    int count = compiled->count;
+    int end = count;            // Falling off the end
+    int epilogue = count + 1;
+    size_t capacity = (size_t)JIT_MAX_INSTRUCTION * (count + 2);
+    
+    // Slot offsets must fit a 32-bit displacement
+    if (compiled->slot_count > INT32_MAX / 8) {
+        return 0;
+    }
+    
+    jit_t jit;
+    size_t* address = malloc(sizeof(size_t) * (count + 2));
+    char* target = calloc(count + 1, 1);
+    jit.fixups = malloc(sizeof(fixup_t) * (2 * count + 1));
+    jit.code = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit.size = 0;
+    jit.fixup_count = 0;
+    jit.cached = -1;
+    
+    int ok = address && target && jit.fixups && jit.code != MAP_FAILED;
+    
+    // rax only carries a value into instructions nothing jumps to
+    for (int i = 0; ok && i < count; i++) {
+        const bytecode_t* code = &compiled->code[i];
+        
+        if (code->op >= BC_BR_EQ_RR && code->op <= BC_BR_GE_RI) {
+            target[compiled->code[++i].dst] = 1;
+        } else if (code->op == BC_IF || code->op == BC_GOTO) {
+            target[code->dst] = 1;
+        }
+    }
+    
+    if (ok) {
+        emit8(&jit, 0x53);          // push rbx
+        emit8(&jit, 0x41);          // push r12
+        emit8(&jit, 0x54);
+        emit8(&jit, 0x48);          // sub rsp, 8 to keep calls 16-byte aligned
+        emit8(&jit, 0x83);
+        emit8(&jit, 0xEC);
+        emit8(&jit, 0x08);
+        emit8(&jit, 0x48);          // mov rbx, rdi
+        emit8(&jit, 0x89);
+        emit8(&jit, 0xFB);
+        emit8(&jit, 0x49);          // mov r12, rsi
+        emit8(&jit, 0x89);
+        emit8(&jit, 0xF4);
+    }
+    
+    for (int i = 0; ok && i < count; i++) {
+        const bytecode_t* code = &compiled->code[i];
+        int op = code->op;
+        
+        address[i] = jit.size;
+        if (target[i]) {
+            jit.cached = -1;
+        }
+        
+        switch (op) {
+            case BC_SET_RR:
+                load_rax(&jit, code->a);
+                store_rax(&jit, code->dst);
+                break;
+                
+            case BC_SET_RI:
+                emit_slot(&jit, 0xC7, 0, code->dst);
+                emit32(&jit, code->b);
+                if (jit.cached == (int)code->dst) {
+                    jit.cached = -1;
+                }
+                break;
+                
+            case BC_ADD_RR: case BC_ADD_RI:
+            case BC_SUB_RR: case BC_SUB_RI:
+            case BC_MUL_RR: case BC_MUL_RI:
+                emit_operation(&jit, code, op & ~1);
+                store_rax(&jit, code->dst);
+                break;
+                
+            case BC_DIV_RR:
+            case BC_DIV_RI:
+                emit_divide(&jit, code, compiled->lines[i], epilogue);
+                break;
+                
+            case BC_OUT_R:
+                emit_slot(&jit, 0x8B, RSI, code->a);
+                emit_output(&jit);
+                emit_call(&jit, (uint64_t)(uintptr_t)output_integer);
+                break;
+                
+            case BC_OUT_S:
+                emit_output(&jit);
+                emit8(&jit, 0x48);  // mov rsi, string
+                emit8(&jit, 0xBE);
+                emit64(&jit, (uint64_t)(uintptr_t)&compiled->strings[code->a]);
+                emit8(&jit, 0xBA);  // mov edx, length
+                emit32(&jit, code->b);
+                emit_call(&jit, (uint64_t)(uintptr_t)output_string);
+                break;
+                
+            case BC_IF:
+                emit_if(&jit, code);
+                break;
+                
+            case BC_GOTO:
+                emit_jump(&jit, 0xE9, code->dst);
+                break;
+                
+            case BC_HALT:
+                emit8(&jit, 0xB8);  // mov eax, 1
+                emit32(&jit, 1);
+                emit_jump(&jit, 0xE9, epilogue);
+                break;
+                
+            default:
+                if (op >= BC_CMP_EQ_RR && op <= BC_CMP_GE_RI) {
+                    emit_operation(&jit, code, BC_CMP_EQ_RR);
+                    emit_setcc(&jit, condition_codes[(op - BC_CMP_EQ_RR) / 2], code->dst);
+                } else if (op >= BC_BR_EQ_RR && op <= BC_BR_GE_RI) {
+                    // The condition is still stored; setcc and mov keep the flags
+                    int condition = condition_codes[(op - BC_BR_EQ_RR) / 2];
+                    emit_operation(&jit, code, BC_CMP_EQ_RR);
+                    emit_setcc(&jit, condition, code->dst);
+                    emit_jump(&jit, 0x0F80 | condition, compiled->code[i + 1].dst);
+                    i++; // The extension word gets its own code below
+                } else {
+                    ok = 0; // Left for the interpreter to report
+                }
+                break;
+        }
+    }
+    
+    if (ok) {
+        address[end] = jit.size;
+        emit_context(&jit);
+        emit_call(&jit, (uint64_t)(uintptr_t)no_halt);
+        emit8(&jit, 0x31);          // xor eax, eax
+        emit8(&jit, 0xC0);
+        address[epilogue] = jit.size;
+        emit8(&jit, 0x48);          // add rsp, 8
+        emit8(&jit, 0x83);
+        emit8(&jit, 0xC4);
+        emit8(&jit, 0x08);
+        emit8(&jit, 0x41);          // pop r12
+        emit8(&jit, 0x5C);
+        emit8(&jit, 0x5B);          // pop rbx
+        emit8(&jit, 0xC3);          // ret
+        
+        // An extension word is skipped by its branch, but still behaves as
+        // an if should anything jump straight to it
+        for (int i = 0; i + 1 < count; i++) {
+            int op = compiled->code[i].op;
+            
+            if (op >= BC_BR_EQ_RR && op <= BC_BR_GE_RI) {
+                i++;
+                address[i] = jit.size;
+                jit.cached = -1;
+                emit_if(&jit, &compiled->code[i]);
+                emit_jump(&jit, 0xE9, i + 1);
+            }
+        }
+        
+        for (int i = 0; i < jit.fixup_count; i++) {
+            int32_t offset = (int32_t)(address[jit.fixups[i].target] - (jit.fixups[i].at + 4));
+            memcpy(jit.code + jit.fixups[i].at, &offset, 4);
+        }
+        
+        // Never writable and executable at the same time
+        ok = mprotect(jit.code, capacity, PROT_READ | PROT_EXEC) == 0;
+    }
+    
+    free(address);
+    free(target);
+    free(jit.fixups);
+    if (!ok) {
+        if (jit.code != MAP_FAILED) {
+            munmap(jit.code, capacity);
+        }
+        return 0;
+    }
+    
+    native->memory = jit.code;
+    native->size = capacity;
+    native->entry = (jit_entry_fn)(uintptr_t)jit.code;
+    return 1;
+}
+
+void jit_free(jit_code_t* native) {
+    munmap(native->memory, native->size);
+    native->memory = NULL;
+}
+
+#else
+
+int jit_compile(const compiled_t* compiled, jit_code_t* native) {
+    (void)compiled;
+    (void)native;
+    return 0;
+}
+
+void jit_free(jit_code_t* native) {
+    (void)native;
+}
+
+#endif
\ No newline at end of file
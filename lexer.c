@@ -1,161 +1,276 @@
 #include "bareword.h"
 
-void print_error(int line, const char* message, const char* detail) {
-    if (detail && strlen(detail) > 0) {
-        fprintf(stderr, "Error at line %d: %s \"%s\"\n", line, message, detail);
-    } else {
-        fprintf(stderr, "Error at line %d: %s\n", line, message);
-    }
+void print_error(const sink_t* sink, int line, const char* message, const char* detail) {
+    span_t span = { detail, detail ? (int)strlen(detail) : 0 };
+    
+    sink->error(sink->user, line, message, span);
+}
+
+void print_error_span(const sink_t* sink, int line, const char* message, span_t detail) {
+    sink->error(sink->user, line, message, detail);
 }
 
-int is_valid_identifier(const char* str) {
-    if (!str || strlen(str) == 0) return 0;
+int span_equals(span_t span, const char* str) {
+    size_t length = strlen(str);
+    
+    return (size_t)span.length == length && memcmp(span.start, str, length) == 0;
+}
+
+int is_valid_identifier(span_t text) {
+    if (text.length == 0) return 0;
     
     // First character must be letter or underscore
-    if (!isalpha(str[0]) && str[0] != '_') return 0;
+    if (!isalpha(text.start[0]) && text.start[0] != '_') return 0;
     
     // Rest can be letters, digits, or underscores
-    for (int i = 1; i < strlen(str); i++) {
-        if (!isalnum(str[i]) && str[i] != '_') return 0;
+    for (int i = 1; i < text.length; i++) {
+        if (!isalnum(text.start[i]) && text.start[i] != '_') return 0;
     }
     
     return 1;
 }
 
-int64_t parse_integer(const char* str) {
-    char* endptr;
-    int64_t value = strtoll(str, &endptr, 10);
+int64_t parse_integer(span_t text) {
+    const char* p = text.start;
+    const char* end = text.start + text.length;
+    int negative = 0;
+    int overflow = 0;
+    uint64_t magnitude = 0;
+    
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end) {
+        return INT64_MIN; // No digits
+    }
     
-    if (*endptr != '\0') {
-        return INT64_MIN; // Invalid integer
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    for (; p < end; p++) {
+        if (!isdigit(*p)) {
+            return INT64_MIN; // Invalid integer
+        }
+        
+        int digit = *p - '0';
+        if (magnitude > (limit - digit) / 10) {
+            overflow = 1;
+        } else {
+            magnitude = magnitude * 10 + digit;
+        }
+    }
+    
+    // Out of range values saturate like strtoll, so a negative one is invalid
+    if (overflow) {
+        return negative ? INT64_MIN : INT64_MAX;
+    }
+    return negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+}
+
+// Keywords and comparison operators, each in its own slot of a perfect
+// hash over the first and last character and the length. The multipliers
+// were found by search and the slots below computed from them; a new
+// keyword needs both regenerated.
+#define KEYWORD_SLOTS 32
+#define KEYWORD_MAX_LENGTH 5
+#define KEYWORD_HASH(first, last, length) (((first) * 5 + (last) * 18 + (length)) % KEYWORD_SLOTS)
+
+typedef struct {
+    const char* text;
+    int length;
+    token_type_t type;
+    int value;          // opcode_t or comparison_t
+} keyword_t;
+
+static const keyword_t keywords[KEYWORD_SLOTS] = {
+    [2] = { ">=", 2, TOKEN_COMPARISON, CMP_GE },
+    [3] = { "div", 3, TOKEN_OPCODE, OP_DIV },
+    [5] = { "<", 1, TOKEN_COMPARISON, CMP_LT },
+    [6] = { "sub", 3, TOKEN_OPCODE, OP_SUB },
+    [10] = { "set", 3, TOKEN_OPCODE, OP_SET },
+    [16] = { "add", 3, TOKEN_OPCODE, OP_ADD },
+    [17] = { "!=", 2, TOKEN_COMPARISON, CMP_NE },
+    [18] = { "cmp", 3, TOKEN_OPCODE, OP_CMP },
+    [19] = { ">", 1, TOKEN_COMPARISON, CMP_GT },
+    [20] = { "halt", 4, TOKEN_OPCODE, OP_HALT },
+    [21] = { "goto", 4, TOKEN_OPCODE, OP_GOTO },
+    [22] = { "out", 3, TOKEN_OPCODE, OP_OUT },
+    [24] = { "<=", 2, TOKEN_COMPARISON, CMP_LE },
+    [25] = { "label", 5, TOKEN_OPCODE, OP_LABEL },
+    [27] = { "if", 2, TOKEN_OPCODE, OP_IF },
+    [28] = { "mul", 3, TOKEN_OPCODE, OP_MUL },
+    [29] = { "==", 2, TOKEN_COMPARISON, CMP_EQ }
+};
+
+// One probe and at most one memcmp, NULL for anything that is not a keyword
+static const keyword_t* find_keyword(span_t text) {
+    if (text.length == 0 || text.length > KEYWORD_MAX_LENGTH) {
+        return NULL;
     }
     
-    return value;
+    const keyword_t* keyword = &keywords[KEYWORD_HASH((unsigned char)text.start[0],
+                                                      (unsigned char)text.start[text.length - 1], text.length)];
+    if (keyword->length != text.length || memcmp(keyword->text, text.start, text.length) != 0) {
+        return NULL;
+    }
+    return keyword;
 }
 
-comparison_t string_to_comparison(const char* str) {
-    if (strcmp(str, "==") == 0) return CMP_EQ;
-    if (strcmp(str, "!=") == 0) return CMP_NE;
-    if (strcmp(str, "<") == 0) return CMP_LT;
-    if (strcmp(str, "<=") == 0) return CMP_LE;
-    if (strcmp(str, ">") == 0) return CMP_GT;
-    if (strcmp(str, ">=") == 0) return CMP_GE;
-    return -1; // Invalid comparison
+comparison_t string_to_comparison(span_t text) {
+    const keyword_t* keyword = find_keyword(text);
+    
+    if (!keyword || keyword->type != TOKEN_COMPARISON) {
+        return -1; // Invalid comparison
+    }
+    return keyword->value;
 }
 
-opcode_t string_to_opcode(const char* str) {
-    if (strcmp(str, "set") == 0) return OP_SET;
-    if (strcmp(str, "out") == 0) return OP_OUT;
-    if (strcmp(str, "add") == 0) return OP_ADD;
-    if (strcmp(str, "sub") == 0) return OP_SUB;
-    if (strcmp(str, "mul") == 0) return OP_MUL;
-    if (strcmp(str, "div") == 0) return OP_DIV;
-    if (strcmp(str, "cmp") == 0) return OP_CMP;
-    if (strcmp(str, "if") == 0) return OP_IF;
-    if (strcmp(str, "goto") == 0) return OP_GOTO;
-    if (strcmp(str, "label") == 0) return OP_LABEL;
-    if (strcmp(str, "halt") == 0) return OP_HALT;
-    return OP_INVALID;
+opcode_t string_to_opcode(span_t text) {
+    const keyword_t* keyword = find_keyword(text);
+    
+    if (!keyword || keyword->type != TOKEN_OPCODE) {
+        return OP_INVALID;
+    }
+    return keyword->value;
 }
 
-int tokenize_line(const char* line, int line_number, token_t tokens[], int* token_count) {
-    *token_count = 0;
+// Type a token that is not a string
+static int classify_token(const lexer_t* lexer, token_t* token) {
+    span_t text = token->text;
+    const keyword_t* keyword = find_keyword(text);
+    
+    // Handle opcodes and comparison operators
+    if (keyword) {
+        token->type = keyword->type;
+        token->value = keyword->value;
+    }
+    // Handle integers
+    else if (isdigit(text.start[0]) || (text.start[0] == '-' && text.length > 1 && isdigit(text.start[1]))) {
+        if (parse_integer(text) == INT64_MIN) {
+            print_error_span(lexer->sink, token->line_number, "invalid integer format", text);
+            return 0;
+        }
+        token->type = TOKEN_INTEGER;
+    }
+    // Handle identifiers
+    else if (is_valid_identifier(text)) {
+        token->type = TOKEN_IDENTIFIER;
+    } else {
+        print_error_span(lexer->sink, token->line_number, "invalid token", text);
+        return 0;
+    }
+    
+    return 1;
+}
+
+int lexer_init(lexer_t* lexer, const char* text, size_t size, const sink_t* sink) {
+    lexer->next = 0;
+    lexer->line_number = 0;
+    lexer->sink = sink;
+    return scanner_init(&lexer->scanner, text, size);
+}
+
+void lexer_free(lexer_t* lexer) {
+    scanner_free(&lexer->scanner);
+}
+
+// Whether another index entry is available, scanning ahead as needed
+static int has_entry(lexer_t* lexer) {
+    scanner_t* scanner = &lexer->scanner;
+    
+    while (lexer->next == scanner->count && !scanner->finished) {
+        scan_window(scanner);
+        lexer->next = 0;
+    }
+    return lexer->next < scanner->count;
+}
+
+int lexer_done(lexer_t* lexer) {
+    return !has_entry(lexer);
+}
+
+// Next structural character; the end of the source reads as a newline
+static char next_entry(lexer_t* lexer, const char** position) {
+    const scanner_t* scanner = &lexer->scanner;
+    uint32_t offset;
     
-    // Skip empty lines and comments
-    if (strlen(line) == 0) return 1;
+    has_entry(lexer);
+    offset = scanner->index[lexer->next++];
+    *position = scanner->text + offset;
+    return offset < scanner->size ? scanner->text[offset] : '\n';
+}
+
+static void skip_line(lexer_t* lexer) {
+    const char* position;
     
-    char buffer[1024];
-    strncpy(buffer, line, sizeof(buffer) - 1);
-    buffer[sizeof(buffer) - 1] = '\0';
+    while (has_entry(lexer) && next_entry(lexer, &position) != '\n');
+}
+
+// Tokens are spans into the source, read off the structural index
+int tokenize_line(lexer_t* lexer, token_t tokens[], int* token_count) {
+    const char* word = NULL;        // Start of the token being read
+    const char* last_quote = NULL;  // Last quote inside it
+    int line_number = ++lexer->line_number;
     
-    char* token = strtok(buffer, " \t\n\r");
+    *token_count = 0;
     
-    while (token != NULL && *token_count < MAX_TOKENS_PER_LINE) {
-        tokens[*token_count].line_number = line_number;
+    while (has_entry(lexer)) {
+        const char* position;
+        char c = next_entry(lexer, &position);
+        
+        // Outside a token every entry but a newline starts one
+        if (!word) {
+            if (c == '\n') break;
+            word = position;
+            last_quote = NULL;
+            continue;
+        }
+        if (c == '"') {
+            last_quote = position;
+            continue;
+        }
+        
+        // Anything else is the separator ending the token
+        token_t* token = &tokens[*token_count];
+        token->line_number = line_number;
+        token->text.start = word;
+        token->text.length = position - word;
+        word = NULL;
         
         // Handle quoted strings
-        if (token[0] == '"') {
-            char string_buffer[MAX_STRING_LENGTH] = "";
-            int string_pos = 0;
-            
-            // Remove starting quote
-            char* start = token + 1;
-            
-            // Check if string ends on same token
-            char* end_quote = strrchr(start, '"');
-            if (end_quote && end_quote > start) {
-                *end_quote = '\0';
-                strncpy(string_buffer, start, MAX_STRING_LENGTH - 1);
-            } else {
-                // Multi-token string - get the rest
-                strncpy(string_buffer, start, MAX_STRING_LENGTH - 1);
-                string_pos = strlen(string_buffer);
-                
-                token = strtok(NULL, "");  // Get rest of line
-                if (token) {
-                    if (string_pos < MAX_STRING_LENGTH - 1) {
-                        string_buffer[string_pos] = ' ';
-                        string_pos++;
-                    }
-                    
-                    char* closing_quote = strchr(token, '"');
-                    if (closing_quote) {
-                        *closing_quote = '\0';
-                        strncat(string_buffer, token, MAX_STRING_LENGTH - string_pos - 1);
-                    } else {
-                        print_error(line_number, "unterminated string literal", "");
-                        return 0;
-                    }
-                } else {
-                    print_error(line_number, "unterminated string literal", "");
-                    return 0;
+        if (token->text.start[0] == '"') {
+            // A quote later in the same word closes the string, otherwise
+            // the string runs on to the next quote in the line
+            while (!last_quote && c != '\n') {
+                c = next_entry(lexer, &position);
+                if (c == '"') {
+                    last_quote = position;
                 }
             }
-            
-            tokens[*token_count].type = TOKEN_STRING;
-            strncpy(tokens[*token_count].value, string_buffer, MAX_TOKEN_LENGTH - 1);
-            tokens[*token_count].value[MAX_TOKEN_LENGTH - 1] = '\0';
-            
-            (*token_count)++;
-            break; // String token consumes rest of line
-        }
-        // Handle comparison operators
-        else if (string_to_comparison(token) != -1) {
-            tokens[*token_count].type = TOKEN_COMPARISON;
-            strncpy(tokens[*token_count].value, token, MAX_TOKEN_LENGTH - 1);
-            tokens[*token_count].value[MAX_TOKEN_LENGTH - 1] = '\0';
-            (*token_count)++;
-        }
-        // Handle integers
-        else if (isdigit(token[0]) || (token[0] == '-' && isdigit(token[1]))) {
-            if (parse_integer(token) == INT64_MIN) {
-                print_error(line_number, "invalid integer format", token);
+            if (!last_quote) {
+                print_error(lexer->sink, line_number, "unterminated string literal", "");
                 return 0;
             }
             
-            tokens[*token_count].type = TOKEN_INTEGER;
-            strncpy(tokens[*token_count].value, token, MAX_TOKEN_LENGTH - 1);
-            tokens[*token_count].value[MAX_TOKEN_LENGTH - 1] = '\0';
+            token->type = TOKEN_STRING;
+            token->text.start++;
+            token->text.length = last_quote - token->text.start;
             (*token_count)++;
-        }
-        // Handle opcodes and identifiers
-        else {
-            opcode_t op = string_to_opcode(token);
-            if (op != OP_INVALID) {
-                tokens[*token_count].type = TOKEN_OPCODE;
-            } else if (is_valid_identifier(token)) {
-                tokens[*token_count].type = TOKEN_IDENTIFIER;
-            } else {
-                print_error(line_number, "invalid token", token);
-                return 0;
-            }
             
-            strncpy(tokens[*token_count].value, token, MAX_TOKEN_LENGTH - 1);
-            tokens[*token_count].value[MAX_TOKEN_LENGTH - 1] = '\0';
-            (*token_count)++;
+            // String token consumes rest of line
+            if (c != '\n') skip_line(lexer);
+            break;
+        }
+        
+        if (!classify_token(lexer, token)) {
+            return 0;
         }
+        (*token_count)++;
         
-        token = strtok(NULL, " \t\n\r");
+        if (c == '\n') break;
+        if (*token_count == MAX_TOKENS_PER_LINE) {
+            skip_line(lexer);
+            break;
+        }
     }
     
     return 1;
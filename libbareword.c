@@ -0,0 +1,208 @@
+#include "bareword.h"
+#include "libbareword.h"
+
+/*
+ * The embedding API over the internal program and context types. Internal
+ * sinks forward to the caller's bw_sink_t; compile-time diagnostics only
+ * reach it while bw_compile runs, so a finished program keeps no pointer
+ * to the caller.
+ */
+
+struct bw_program {
+    program_t program;
+};
+
+struct bw_context {
+    context_t context;
+    sink_t sink;            // Forwards to user
+    bw_sink_t user;
+    engine_fn engine;
+};
+
+static const bw_sink_t no_sink = { NULL, NULL, NULL };
+
+static void forward_write(void* user, const char* data, size_t size) {
+    const bw_sink_t* sink = user;
+    
+    if (sink->write) {
+        sink->write(sink->user, data, size);
+    }
+}
+
+// Messages reach the caller as one string, the detail quoted after it
+static void forward_error(void* user, int line, const char* message, span_t detail) {
+    const bw_sink_t* sink = user;
+    char text[256];
+    
+    if (!sink->error) {
+        return;
+    }
+    if (detail.length > 0) {
+        snprintf(text, sizeof(text), "%s \"%.*s\"", message, detail.length, detail.start);
+        sink->error(sink->user, line, text);
+    } else {
+        sink->error(sink->user, line, message);
+    }
+}
+
+static bw_status_t compile(program_t* program, int opt_level, const bw_sink_t* sink) {
+    sink_t diagnostics = { forward_write, forward_error, (void*)(sink ? sink : &no_sink) };
+    bw_status_t status = BW_OK;
+    optimize_stats_t stats;
+    
+    program->sink = &diagnostics;
+    if (!parse_source(program)) {
+        status = BW_ERROR_SYNTAX;
+    } else if (!validate_program(program)) {
+        status = BW_ERROR_VALIDATION;
+    } else if (opt_level > 0) {
+        // bw_get_variable may read any variable once the run is over
+        program->variables_observed = 1;
+        optimize_program(program, opt_level, &stats);
+    }
+    program->sink = NULL;
+    return status;
+}
+
+static bw_status_t finish_compile(bw_program_t* compiled, int opt_level, const bw_sink_t* sink,
+                                  bw_program_t** program) {
+    bw_status_t status = compile(&compiled->program, opt_level, sink);
+    
+    if (status != BW_OK) {
+        bw_program_free(compiled);
+        return status;
+    }
+    *program = compiled;
+    return BW_OK;
+}
+
+bw_status_t bw_compile(const char* source, size_t size, int opt_level, const bw_sink_t* sink,
+                       bw_program_t** program) {
+    *program = NULL;
+    if (opt_level < 0 || opt_level > 2) {
+        return BW_ERROR_ARGUMENT;
+    }
+    
+    bw_program_t* compiled = malloc(sizeof(*compiled));
+    if (!compiled) {
+        return BW_ERROR_MEMORY;
+    }
+    init_program(&compiled->program);
+    
+    // Names point into the text, so the program keeps its own copy
+    char* text = arena_alloc(&compiled->program.arena, size + 1);
+    if (!text) {
+        bw_program_free(compiled);
+        return BW_ERROR_MEMORY;
+    }
+    memcpy(text, source, size);
+    compiled->program.source = text;
+    compiled->program.source_size = size;
+    
+    return finish_compile(compiled, opt_level, sink, program);
+}
+
+bw_status_t bw_compile_file(const char* path, int opt_level, const bw_sink_t* sink, bw_program_t** program) {
+    *program = NULL;
+    if (opt_level < 0 || opt_level > 2) {
+        return BW_ERROR_ARGUMENT;
+    }
+    
+    bw_program_t* compiled = malloc(sizeof(*compiled));
+    if (!compiled) {
+        return BW_ERROR_MEMORY;
+    }
+    init_program(&compiled->program);
+    
+    if (!load_source(path, &compiled->program)) {
+        bw_program_free(compiled);
+        return BW_ERROR_IO;
+    }
+    return finish_compile(compiled, opt_level, sink, program);
+}
+
+void bw_program_free(bw_program_t* program) {
+    if (program) {
+        free_program(&program->program);
+        free(program);
+    }
+}
+
+bw_status_t bw_context_new(const bw_program_t* program, const bw_sink_t* sink, bw_context_t** context) {
+    bw_context_t* created = malloc(sizeof(*created));
+    
+    *context = NULL;
+    if (!created) {
+        return BW_ERROR_MEMORY;
+    }
+    created->user = sink ? *sink : no_sink;
+    created->sink.write = forward_write;
+    created->sink.error = forward_error;
+    created->sink.user = &created->user;
+    created->engine = execute_program;
+    
+    if (!context_init(&created->context, &program->program, &created->sink)) {
+        context_free(&created->context);
+        free(created);
+        return BW_ERROR_MEMORY;
+    }
+    *context = created;
+    return BW_OK;
+}
+
+void bw_context_free(bw_context_t* context) {
+    if (context) {
+        context_free(&context->context);
+        free(context);
+    }
+}
+
+bw_status_t bw_set_engine(bw_context_t* context, const char* name) {
+    engine_fn engine = find_engine(name);
+    
+    if (!engine) {
+        return BW_ERROR_ARGUMENT;
+    }
+    context->engine = engine;
+    return BW_OK;
+}
+
+bw_status_t bw_run(bw_context_t* context) {
+    int ok = context->engine(&context->context);
+    
+    output_flush(&context->context.output);
+    return ok ? BW_OK : BW_ERROR_RUNTIME;
+}
+
+bw_status_t bw_get_variable(const bw_context_t* context, const char* name, int64_t* value) {
+    const program_t* program = context->context.program;
+    
+    for (int i = 0; i < program->variable_count; i++) {
+        if (span_equals(program->symbols[i].name, name)) {
+            *value = context->context.values[i];
+            return BW_OK;
+        }
+    }
+    return BW_ERROR_ARGUMENT;
+}
+
+int bw_error_line(const bw_context_t* context) {
+    return context->context.error_line;
+}
+
+const char* bw_status_string(bw_status_t status) {
+    static const char* const names[] = {
+        "ok",
+        "cannot read source",
+        "syntax error",
+        "validation error",
+        "runtime error",
+        "out of memory",
+        "invalid argument"
+    };
+    
+    if ((unsigned)status >= sizeof(names) / sizeof(names[0])) {
+        return "unknown status";
+    }
+    return names[status];
+}
\ No newline at end of file
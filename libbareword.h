@@ -0,0 +1,84 @@
+#ifndef LIBBAREWORD_H
+#define LIBBAREWORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Embedding API for Bareword.
+ *
+ * A program is compiled once into a bw_program_t, which is never modified
+ * afterwards and can be shared by any number of threads. Each run happens
+ * in a bw_context_t holding that run's variables and buffered output; a
+ * context belongs to one thread at a time, and any number of contexts can
+ * run the same program at once. The library keeps no global state and never
+ * exits the process: failures are returned as a bw_status_t, and the
+ * messages behind them go to the caller's sink.
+ *
+ *   bw_program_t* program;
+ *   bw_context_t* context;
+ *
+ *   if (bw_compile(source, size, 2, &sink, &program) == BW_OK &&
+ *       bw_context_new(program, &sink, &context) == BW_OK) {
+ *       bw_status_t status = bw_run(context);
+ *       ...
+ *       bw_context_free(context);
+ *   }
+ *   bw_program_free(program);
+ */
+
+#if defined(__GNUC__)
+#define BW_API __attribute__((visibility("default")))
+#else
+#define BW_API
+#endif
+
+typedef struct bw_program bw_program_t;
+typedef struct bw_context bw_context_t;
+
+typedef enum {
+    BW_OK = 0,              // Compiled, or the program reached halt
+    BW_ERROR_IO,            // The source file could not be read
+    BW_ERROR_SYNTAX,        // Rejected by the lexer or parser
+    BW_ERROR_VALIDATION,    // Rejected by the validator
+    BW_ERROR_RUNTIME,       // Division by zero, or the program ran off its end
+    BW_ERROR_MEMORY,
+    BW_ERROR_ARGUMENT       // Unknown engine or variable, bad option
+} bw_status_t;
+
+// Receives program output and error messages. Either callback may be NULL
+// to discard. Messages are complete, e.g. 'invalid token "x"'; line is 0
+// for errors not tied to a source line.
+typedef struct {
+    void (*write)(void* user, const char* data, size_t size);
+    void (*error)(void* user, int line, const char* message);
+    void* user;
+} bw_sink_t;
+
+// Compile source text at optimization level 0 to 2. The text is copied,
+// diagnostics go to sink, which may be NULL.
+BW_API bw_status_t bw_compile(const char* source, size_t size, int opt_level, const bw_sink_t* sink,
+                              bw_program_t** program);
+BW_API bw_status_t bw_compile_file(const char* path, int opt_level, const bw_sink_t* sink, bw_program_t** program);
+BW_API void bw_program_free(bw_program_t* program);
+
+// A context for running program, which must outlive it. Output and runtime
+// errors go to sink, which is copied.
+BW_API bw_status_t bw_context_new(const bw_program_t* program, const bw_sink_t* sink, bw_context_t** context);
+BW_API void bw_context_free(bw_context_t* context);
+
+// "threaded" (default), "switch" or "jit"
+BW_API bw_status_t bw_set_engine(bw_context_t* context, const char* name);
+
+// Run the program from the start with all variables zero. All output has
+// been passed to the sink when it returns.
+BW_API bw_status_t bw_run(bw_context_t* context);
+
+// A variable's value after a run, at every optimization level, and the line of the error that ended it
+// (-1 if none, 0 for an error without a line)
+BW_API bw_status_t bw_get_variable(const bw_context_t* context, const char* name, int64_t* value);
+BW_API int bw_error_line(const bw_context_t* context);
+
+BW_API const char* bw_status_string(bw_status_t status);
+
+#endif // LIBBAREWORD_H
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "bareword.h"
+
+int constant_slot(program_t* program, int64_t value) {
+    compiled_t* compiled = &program->compiled;
+    hash_index_t* index = &program->constant_index;
+    uint32_t hash = (uint32_t)hash_source((const char*)&value, sizeof(value));
+    
+    if (!hash_index_reserve(&program->arena, index, compiled->constant_count + 1)) {
+        return -1;
+    }
+    hash_entry_t* entry = hash_index_probe(index, hash);
+    for (; entry->item; entry = hash_index_next(index, entry)) {
+        if (compiled->constants[entry->item - 1] == value) {
+            return program->variable_count + entry->item - 1;
+        }
+    }
+    
+    int64_t* constants = arena_reserve(&program->arena, compiled->constants, compiled->constant_count + 1,
+                                       &compiled->constant_capacity, sizeof(int64_t));
+    if (!constants) {
+        return -1;
+    }
+    compiled->constants = constants;
+    
+    hash_index_insert(index, entry, compiled->constant_count, hash);
+    compiled->constants[compiled->constant_count++] = value;
+    compiled->slot_count = program->variable_count + compiled->constant_count;
+    return compiled->slot_count - 1;
+}
+
+// Copy a string literal into the pool, NUL-terminated
+static uint32_t string_offset(program_t* program, span_t str) {
+    compiled_t* compiled = &program->compiled;
+    int offset = compiled->string_size;
+    
+    memcpy(&compiled->strings[offset], str.start, str.length);
+    compiled->strings[offset + str.length] = '\0';
+    compiled->string_size += str.length + 1;
+    return offset;
+}
+
+// Value operand: the variable's slot, or a constant slot holding the literal
+static uint32_t value_slot(program_t* program, const instruction_t* inst, int index) {
+    if (inst->slots[index] != -1) {
+        return inst->slots[index];
+    }
+    return constant_slot(program, parse_integer(inst->args[index]));
+}
+
+// Literal operand that fits the 32-bit immediate field
+static int is_immediate(const instruction_t* inst, int index) {
+    if (inst->slots[index] != -1) {
+        return 0;
+    }
+    int64_t value = parse_integer(inst->args[index]);
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Binary value operation: the _RI form when the right operand is a literal
+static void lower_binary(program_t* program, const instruction_t* inst, bytecode_t* code,
+                         int rr_op, int left, int right) {
+    code->dst = inst->slots[0];
+    code->a = value_slot(program, inst, left);
+    if (is_immediate(inst, right)) {
+        code->op = rr_op + 1;
+        code->b = (uint32_t)(int32_t)parse_integer(inst->args[right]);
+    } else {
+        code->op = rr_op;
+        code->b = value_slot(program, inst, right);
+    }
+}
+
+// The same comparison with its operands swapped
+static comparison_t mirror_comparison(comparison_t cmp) {
+    switch (cmp) {
+        case CMP_LT: return CMP_GT;
+        case CMP_LE: return CMP_GE;
+        case CMP_GT: return CMP_LT;
+        case CMP_GE: return CMP_LE;
+        default: return cmp;
+    }
+}
+
+int lower_program(program_t* program) {
+    compiled_t* compiled = &program->compiled;
+    int count = program->instruction_count;
+    int string_bytes = 0;
+    
+    // Reserve the worst case up front so lowering itself cannot fail:
+    // at most two constants per instruction and every out argument as a string
+    for (int i = 0; i < count; i++) {
+        if (program->instructions[i].op == OP_OUT) {
+            string_bytes += program->instructions[i].args[0].length + 1;
+        }
+    }
+    
+    memset(compiled, 0, sizeof(*compiled));
+    memset(&program->constant_index, 0, sizeof(program->constant_index));
+    compiled->code = arena_alloc(&program->arena, sizeof(bytecode_t) * count);
+    compiled->lines = arena_alloc(&program->arena, sizeof(int) * count);
+    compiled->constants = arena_reserve(&program->arena, NULL, 2 * count + 1,
+                                        &compiled->constant_capacity, sizeof(int64_t));
+    compiled->strings = arena_reserve(&program->arena, NULL, string_bytes + 1,
+                                      &compiled->string_capacity, 1);
+    program->blocks = arena_alloc(&program->arena, sizeof(block_t) * count);
+    program->block_of = arena_alloc(&program->arena, sizeof(int) * (count + 1));
+    
+    if (!compiled->code || !compiled->lines || !compiled->constants || !compiled->strings ||
+        !program->blocks || !program->block_of ||
+        !hash_index_reserve(&program->arena, &program->constant_index, 2 * count + 1)) {
+        return 0;
+    }
+    
+    for (int i = 0; i < program->instruction_count; i++) {
+        instruction_t* inst = &program->instructions[i];
+        bytecode_t* code = &compiled->code[compiled->count];
+        
+        memset(code, 0, sizeof(*code));
+        compiled->lines[compiled->count] = inst->line_number;
+        
+        switch (inst->op) {
+            case OP_SET:
+                code->dst = inst->slots[0];
+                if (is_immediate(inst, 1)) {
+                    code->op = BC_SET_RI;
+                    code->b = (uint32_t)(int32_t)parse_integer(inst->args[1]);
+                } else {
+                    code->op = BC_SET_RR;
+                    code->a = value_slot(program, inst, 1);
+                }
+                break;
+                
+            case OP_OUT:
+                if (is_text_operand(inst)) {
+                    code->op = BC_OUT_S;
+                    code->a = string_offset(program, inst->args[0]);
+                    code->b = inst->args[0].length;
+                } else {
+                    code->op = BC_OUT_R;
+                    code->a = value_slot(program, inst, 0);
+                }
+                break;
+                
+            case OP_ADD:
+            case OP_MUL: {
+                int rr_op = inst->op == OP_ADD ? BC_ADD_RR : BC_MUL_RR;
+                
+                // Commutative: move a lone literal to the immediate side
+                if (is_immediate(inst, 1) && !is_immediate(inst, 2)) {
+                    lower_binary(program, inst, code, rr_op, 2, 1);
+                } else {
+                    lower_binary(program, inst, code, rr_op, 1, 2);
+                }
+                break;
+            }
+            
+            case OP_SUB:
+                lower_binary(program, inst, code, BC_SUB_RR, 1, 2);
+                break;
+                
+            case OP_DIV:
+                lower_binary(program, inst, code, BC_DIV_RR, 1, 2);
+                
+                // A zero divisor must keep the runtime check
+                if (code->op == BC_DIV_RI && code->b == 0) {
+                    code->op = BC_DIV_RR;
+                    code->b = constant_slot(program, 0);
+                }
+                break;
+                
+            case OP_CMP: {
+                comparison_t cmp = inst->cmp;
+                
+                if (is_immediate(inst, 1) && !is_immediate(inst, 3)) {
+                    lower_binary(program, inst, code, BC_CMP_EQ_RR + 2 * mirror_comparison(cmp), 3, 1);
+                } else {
+                    lower_binary(program, inst, code, BC_CMP_EQ_RR + 2 * cmp, 1, 3);
+                }
+                break;
+            }
+            
+            case OP_IF:
+                code->op = BC_IF;
+                code->dst = inst->target;
+                code->a = inst->slots[0];
+                break;
+                
+            case OP_GOTO:
+                code->op = BC_GOTO;
+                code->dst = inst->target;
+                break;
+                
+            case OP_HALT:
+            default:
+                code->op = BC_HALT;
+                break;
+        }
+        
+        compiled->count++;
+    }
+    
+    compiled->slot_count = program->variable_count + compiled->constant_count;
+    return 1;
+}
\ No newline at end of file
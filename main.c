@@ -1,8 +1,55 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <unistd.h>
 #include "bareword.h"
 
+#define TRACE_RECORDS (64 * 1024)     // Steps kept by --trace, 16 bytes each
+#define TRACE_ERROR_STEPS 10            // Steps listed after a runtime error
+
+typedef enum {
+    PHASE_PARSE,
+    PHASE_VALIDATE,
+    PHASE_OPTIMIZE,
+    PHASE_EXECUTE,
+    PHASE_COUNT
+} phase_t;
+
+static const char* const phase_names[] = { "parse", "validate", "optimize", "execute" };
+
+// Wall and CPU seconds spent in each phase, for --stats
+typedef struct {
+    double wall[PHASE_COUNT];
+    double cpu[PHASE_COUNT];
+    double wall_start;
+    double cpu_start;
+} stats_t;
+
 void print_usage(const char* program_name) {
-    printf("Usage: %s <program.bw>\n", program_name);
-    printf("  Execute a Bareword program\n\n");
+    printf("Usage: %s [options] <program.bw|program.bwc>\n", program_name);
+    printf("       %s --batch [options] [--manifest=FILE] <program.bw>...\n", program_name);
+    printf("       %s --sweep=TABLE [options] <program.bw>\n", program_name);
+    printf("       %s [--flush=POLICY] [-q] -\n", program_name);
+    printf("       %s --dump-trace=FILE\n", program_name);
+    printf("  Execute a Bareword program, or many at once; - runs standard input while it is read\n\n");
+    printf("Options:\n");
+    printf("  -O1              Fuse compare-and-branch pairs and remove redundant jumps\n");
+    printf("  -O2              Also propagate constants and remove dead code\n");
+    printf("  --engine=NAME    Execution engine: threaded (default), switch or jit\n");
+    printf("  --flush=POLICY   Write output after every line, when the buffer is full, or at exit\n");
+    printf("  --cache          Reuse or write a bytecode image beside the source (program.bwc)\n");
+    printf("  --cache-dir=DIR  Keep bytecode images in DIR instead\n");
+    printf("  --compile        Only write the bytecode image, do not execute\n");
+    printf("  --emit-c         Write the program as a standalone C file to stdout, do not execute\n");
+    printf("  --stats          Report phase times, instructions, memory and output size on stderr\n");
+    printf("  -q, --quiet      Print only the program's output, no banners\n");
+    printf("  --profile        Count executions and time per line, print the hottest lines at exit\n");
+    printf("  --profile-json=FILE  Also write the profile to FILE as JSON\n");
+    printf("  --trace=FILE     Record the last %d steps into FILE, a ring buffer kept on disk\n", TRACE_RECORDS);
+    printf("  --dump-trace=FILE  List the steps recorded in FILE with their source lines\n");
+    printf("  --batch          Run every program given, in parallel, with output in argument order\n");
+    printf("  --manifest=FILE  Also run the programs listed in FILE, one path per line (implies --batch)\n");
+    printf("  --jobs=N         Worker threads for --batch and for parsing large files (default: one per CPU)\n");
+    printf("  --sweep=TABLE    Run once per row of a CSV table of starting values, several rows at a time\n\n");
     printf("Bareword Language Reference:\n");
     printf("  set var value    - Set variable to value\n");
     printf("  out value        - Output value or string\n");
@@ -24,47 +71,447 @@ void print_usage(const char* program_name) {
     printf("  halt\n");
 }
 
+// Translate to C on stdout; diagnostics are the interpreter's own
+static int emit_c_source(const char* filename) {
+    program_t program;
+    
+    if (!parse_program(filename, &program)) {
+        fprintf(stderr, "Parsing failed.\n");
+        free_program(&program);
+        return 1;
+    }
+    if (!validate_program(&program)) {
+        fprintf(stderr, "Validation failed.\n");
+        free_program(&program);
+        return 1;
+    }
+    
+    int ok = emit_c(&program, filename, stdout);
+    free_program(&program);
+    if (!ok) {
+        fprintf(stderr, "Error: cannot write C output\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void read_clocks(double* wall, double* cpu) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *wall = ts.tv_sec + ts.tv_nsec / 1e9;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    *cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void phase_begin(stats_t* stats) {
+    read_clocks(&stats->wall_start, &stats->cpu_start);
+}
+
+static void phase_end(stats_t* stats, phase_t phase) {
+    double wall;
+    double cpu;
+    
+    read_clocks(&wall, &cpu);
+    stats->wall[phase] += wall - stats->wall_start;
+    stats->cpu[phase] += cpu - stats->cpu_start;
+}
+
+// The first phase_count phases, which is all of them after a run
+static void print_phases(const stats_t* stats, int phase_count, int cached) {
+    fprintf(stderr, "\nStats:\n");
+    for (int i = 0; i < phase_count; i++) {
+        fprintf(stderr, "  %-12s %10.3f ms wall %10.3f ms cpu%s\n", phase_names[i], stats->wall[i] * 1e3,
+                stats->cpu[i] * 1e3, cached && i != PHASE_EXECUTE ? (i == PHASE_PARSE ? "  (image load)" : "  (cached)") : "");
+    }
+}
+
+// Labels come from info, since images do not keep them
+static void print_stats(const stats_t* stats, const program_t* program, const image_info_t* info,
+                        const context_t* context, int counted, int cached) {
+    double execute = stats->wall[PHASE_EXECUTE];
+    
+    print_phases(stats, PHASE_COUNT, cached);
+    if (counted) {
+        fprintf(stderr, "  instructions %llu retired, %.1f M/s\n", (unsigned long long)context->executed,
+                execute > 0 ? context->executed / execute / 1e6 : 0.0);
+    } else {
+        fprintf(stderr, "  instructions not counted by this engine\n");
+    }
+    fprintf(stderr, "  symbols      %d variables, %d labels\n", program->variable_count, info->label_count);
+    fprintf(stderr, "  memory       %zu bytes in the program arena", program->arena.reserved);
+    if (program->source_mapped) {
+        fprintf(stderr, ", %zu bytes of source mapped", program->source_size);
+    }
+    if (program->image) {
+        fprintf(stderr, ", %zu bytes of image mapped", program->image_size);
+    }
+    fprintf(stderr, "\n  output       %llu bytes\n", (unsigned long long)context->output.written);
+}
+
+// Listing on stderr, and the JSON form to json_path if given
+static int write_profile(const program_t* program, const profile_t* profile, const char* filename,
+                         const char* json_path) {
+    print_profile(program, profile, stderr);
+    if (!json_path) {
+        return 1;
+    }
+    
+    FILE* file = fopen(json_path, "w");
+    int ok = file && write_profile_json(program, profile, filename, file);
+    if (file && fclose(file) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: cannot write profile '%s'\n", json_path);
+    }
+    return ok;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
+    const char** files = (const char**)argv + 1;  // Collected in place
+    int file_count = 0;
+    engine_fn engine = execute_program;
+    int engine_set = 0;
+    int opt_level = 0;
+    flush_policy_t flush_policy = output_default_policy();
+    int use_cache = 0;
+    int compile_only = 0;
+    int emit_only = 0;
+    const char* cache_dir = NULL;
+    int batch = 0;
+    int jobs = 0;
+    const char* manifest = NULL;
+    int profile = 0;
+    const char* profile_json = NULL;
+    const char* sweep = NULL;
+    const char* trace_path = NULL;
+    int show_stats = 0;
+    int quiet = 0;
+    stats_t stats;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0) {
+            opt_level = argv[i][2] - '0';
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            engine = find_engine(argv[i] + 9);
+            if (!engine) {
+                fprintf(stderr, "Error: unknown engine '%s'\n", argv[i] + 9);
+                return 1;
+            }
+            engine_set = 1;
+        } else if (strncmp(argv[i], "--flush=", 8) == 0) {
+            flush_policy = find_flush_policy(argv[i] + 8);
+            if ((int)flush_policy == -1) {
+                fprintf(stderr, "Error: unknown flush policy '%s'\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = 1;
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            use_cache = 1;
+            cache_dir = argv[i] + 12;
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            compile_only = 1;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            emit_only = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        } else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strncmp(argv[i], "--profile-json=", 15) == 0) {
+            profile = 1;
+            profile_json = argv[i] + 15;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--dump-trace=", 13) == 0) {
+            const char* path = argv[i] + 13;
+            int dumped = dump_trace(path, 0, stdout);
+            if (dumped == -1) {
+                fprintf(stderr, "Error: cannot open trace '%s'\n", path);
+            } else if (!dumped) {
+                fprintf(stderr, "Error: '%s' is not a trace file for this version\n", path);
+            }
+            return dumped == 1 ? 0 : 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if (strncmp(argv[i], "--manifest=", 11) == 0) {
+            batch = 1;
+            manifest = argv[i] + 11;
+        } else if (strncmp(argv[i], "--sweep=", 8) == 0) {
+            sweep = argv[i] + 8;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            char* end;
+            long value = strtol(argv[i] + 7, &end, 10);
+            if (end == argv[i] + 7 || *end != '\0' || value < 1 || value > 4096) {
+                fprintf(stderr, "Error: invalid job count '%s'\n", argv[i] + 7);
+                return 1;
+            }
+            jobs = (int)value;
+        } else {
+            files[file_count++] = argv[i];
+        }
+    }
+    
+    // Counting and tracing are separate engines, so no other run pays for them
+    if (profile && trace_path) {
+        fprintf(stderr, "Error: --trace cannot be combined with --profile\n");
+        return 1;
+    }
+    if (engine_set && (profile || trace_path)) {
+        fprintf(stderr, "Error: --engine cannot be combined with --profile or --trace\n");
+        return 1;
+    }
+    if (profile) {
+        engine = execute_profiled;
+    }
+    if (trace_path) {
+        engine = execute_traced;
+    }
+    engine_fn counted = show_stats ? counting_engine(engine) : NULL;
+    if (counted) {
+        engine = counted;
+    }
+    
+    if (batch) {
+        if (use_cache || compile_only || emit_only || profile || trace_path) {
+            fprintf(stderr, "Error: --batch cannot be combined with --cache, --compile, --emit-c, --profile or --trace\n");
+            return 1;
+        }
+        if (file_count == 0 && !manifest) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        
+        batch_options_t options = { jobs, opt_level, engine };
+        return run_batch(files, file_count, manifest, &options);
+    }
+    
+    if (file_count != 1) {
         print_usage(argv[0]);
         return 1;
     }
+    const char* filename = files[0];
     
-    const char* filename = argv[1];
+    // Streaming runs straight off the input, without separate phases
+    if (strcmp(filename, "-") == 0) {
+        if (opt_level > 0 || engine_set || use_cache || compile_only || emit_only || profile || show_stats ||
+            sweep || trace_path) {
+            fprintf(stderr, "Error: a streamed program cannot be combined with -O, --engine, --cache, --compile, "
+                    "--emit-c, --profile, --stats, --sweep or --trace\n");
+            return 1;
+        }
+        if (!quiet) {
+            printf("Bareword Interpreter v1.0\n");
+            printf("Streaming standard input, executing as it is parsed...\n\n");
+        }
+        return run_stream(STDIN_FILENO, flush_policy, quiet);
+    }
     
-    // Check file extension
+    // Check file extension; .bwc files are precompiled images
     const char* ext = strrchr(filename, '.');
-    if (!ext || strcmp(ext, ".bw") != 0) {
+    int is_image = ext && strcmp(ext, ".bwc") == 0;
+    if (!is_image && (!ext || strcmp(ext, ".bw") != 0)) {
         fprintf(stderr, "Warning: Bareword programs should have .bw extension\n");
     }
+    if (is_image && (compile_only || emit_only)) {
+        fprintf(stderr, "Error: '%s' is already compiled\n", filename);
+        return 1;
+    }
+    if (emit_only) {
+        return emit_c_source(filename);
+    }
+    if (sweep) {
+        // Images keep no variable names to bind columns to, and sweeps run
+        // on their own interpreter
+        if (is_image || engine_set || show_stats || use_cache || compile_only || profile || trace_path) {
+            fprintf(stderr, "Error: --sweep needs a source program and cannot be combined with --engine, --stats, "
+                    "--cache, --compile, --profile or --trace\n");
+            return 1;
+        }
+        // Constant propagation assumes every variable starts at 0
+        if (opt_level > 1) {
+            opt_level = 1;
+        }
+    }
     
     program_t program;
+    image_info_t info;
+    char* cache_path = NULL;
+    int cached = 0;
     
-    printf("Bareword Interpreter v1.0\n");
-    printf("Parsing '%s'...\n", filename);
+    if (!quiet) {
+        printf("Bareword Interpreter v1.0\n");
+        printf("Parsing '%s'...\n", filename);
+    }
+    
+    memset(&info, 0, sizeof(info));
+    memset(&stats, 0, sizeof(stats));
+    phase_begin(&stats);
+    if (is_image) {
+        // Run the image as is, at the level it was compiled with
+        init_program(&program);
+        if (!load_image(&program, filename, NULL, &info)) {
+            fprintf(stderr, "Error: '%s' is not a bytecode image for this version\n", filename);
+            free_program(&program);
+            return 1;
+        }
+        cached = 1;
+        opt_level = info.opt_level;
+    } else {
+        if (!load_program(filename, &program)) {
+            fprintf(stderr, "Parsing failed.\n");
+            free_program(&program);
+            return 1;
+        }
+        
+        // A cached image built from the same text at the same level skips
+        // parsing, validation and optimization entirely
+        if (use_cache || compile_only) {
+            info.source_hash = hash_source(program.source, program.source_size);
+            info.opt_level = opt_level;
+            cache_path = image_path(filename, cache_dir, &info);
+            if (use_cache && cache_path) {
+                image_info_t expected = info;
+                cached = load_image(&program, cache_path, &expected, &info);
+            }
+        }
+    }
     
     // Parse the program
-    if (!parse_program(filename, &program)) {
-        fprintf(stderr, "Parsing failed.\n");
-        return 1;
+    if (!cached) {
+        if (!parse_source_jobs(&program, jobs)) {
+            fprintf(stderr, "Parsing failed.\n");
+            free(cache_path);
+            free_program(&program);
+            return 1;
+        }
+        info.instruction_count = program.instruction_count;
+        info.label_count = program.label_count;
     }
+    phase_end(&stats, PHASE_PARSE);
     
-    printf("Parsed %d instructions, %d labels\n", program.instruction_count, program.label_count);
+    if (!quiet) {
+        printf("Parsed %d instructions, %d labels\n", info.instruction_count, info.label_count);
+    }
     
-    // Validate the program
-    if (!validate_program(&program)) {
-        fprintf(stderr, "Validation failed.\n");
-        return 1;
+    if (!cached) {
+        // Validate the program
+        phase_begin(&stats);
+        int valid = validate_program(&program);
+        phase_end(&stats, PHASE_VALIDATE);
+        if (!valid) {
+            fprintf(stderr, "Validation failed.\n");
+            free(cache_path);
+            free_program(&program);
+            return 1;
+        }
+        
+        if (opt_level > 0) {
+            phase_begin(&stats);
+            optimize_program(&program, opt_level, &info.stats);
+            phase_end(&stats, PHASE_OPTIMIZE);
+        }
+        
+        if (cache_path && !save_image(&program, cache_path, &info)) {
+            fprintf(stderr, "Warning: cannot write bytecode image '%s'\n", cache_path);
+            if (compile_only) {
+                free(cache_path);
+                free_program(&program);
+                return 1;
+            }
+        }
     }
     
-    printf("Validation passed. Executing...\n\n");
+    if (opt_level > 0 && !quiet) {
+        printf("Optimized: fused %d compare-and-branch pairs, merged %d sets, removed %d jumps\n",
+               info.stats.fused, info.stats.merged, info.stats.jumps_removed);
+        if (opt_level >= 2) {
+            printf("Optimized: folded %d constants, resolved %d branches, removed %d dead instructions\n",
+                   info.stats.folded, info.stats.branches_resolved, info.stats.dead_removed);
+            if (info.stats.propagation_skipped) {
+                printf("Optimized: skipped constant propagation, too many blocks and variables\n");
+            }
+        }
+    }
+    
+    if (compile_only) {
+        if (!quiet) {
+            printf("Compiled to '%s'\n", cache_path);
+        }
+        if (show_stats) {
+            print_phases(&stats, PHASE_EXECUTE, cached);
+        }
+        free(cache_path);
+        free_program(&program);
+        return 0;
+    }
+    free(cache_path);
+    
+    if (!quiet) {
+        printf("Validation passed. Executing...\n\n");
+    }
+    
+    if (sweep) {
+        int status = run_sweep(&program, sweep);
+        free_program(&program);
+        return status;
+    }
     
     // Execute the program
-    if (!execute_program(&program)) {
+    context_t context;
+    if (!context_init(&context, &program, &stdio_sink)) {
+        fprintf(stderr, "Error: out of memory\n");
+        context_free(&context);
+        free_program(&program);
+        return 1;
+    }
+    context.output.policy = flush_policy;
+    if (trace_path) {
+        context.trace = trace_open(trace_path, &program, filename, TRACE_RECORDS);
+        if (!context.trace) {
+            fprintf(stderr, "Error: cannot create trace '%s'\n", trace_path);
+            context_free(&context);
+            free_program(&program);
+            return 1;
+        }
+    }
+    
+    phase_begin(&stats);
+    int ok = engine(&context);
+    output_flush(&context.output);
+    phase_end(&stats, PHASE_EXECUTE);
+    if (context.trace) {
+        trace_close(context.trace);
+        context.trace = NULL;
+        
+        // The history leading up to the error, read back from the file
+        if (!ok) {
+            fprintf(stderr, "\n");
+            dump_trace(trace_path, TRACE_ERROR_STEPS, stderr);
+        }
+    }
+    if (profile && context.profile) {
+        int written = write_profile(&program, context.profile, filename, profile_json);
+        if (ok && !written) {
+            ok = 0;
+        }
+    }
+    if (show_stats) {
+        print_stats(&stats, &program, &info, &context, counted != NULL, cached);
+    }
+    context_free(&context);
+    if (!ok) {
         fprintf(stderr, "\nExecution failed.\n");
+        free_program(&program);
         return 1;
     }
     
-    printf("\nProgram completed successfully.\n");
+    free_program(&program);
+    if (!quiet) {
+        printf("\nProgram completed successfully.\n");
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,649 @@
+#include "bareword.h"
+
+// Value operations are (_RR, _RI) pairs from BC_SET_RR to BC_BR_GE_RI
+static int is_value_op(int op) {
+    return op >= BC_SET_RR && op <= BC_BR_GE_RI;
+}
+
+static int is_immediate_form(int op) {
+    return (op - BC_SET_RR) & 1;
+}
+
+static int is_compare(int op) {
+    return op >= BC_CMP_EQ_RR && op <= BC_CMP_GE_RI;
+}
+
+static int is_fused_branch(int op) {
+    return op >= BC_BR_EQ_RR && op <= BC_BR_GE_RI;
+}
+
+static int is_commutative(int op) {
+    return op == BC_ADD_RR || op == BC_MUL_RR;
+}
+
+// Slots an instruction reads, returns how many
+static int read_slots(const bytecode_t* code, uint32_t slots[2]) {
+    if (code->op == BC_SET_RR || code->op == BC_OUT_R || code->op == BC_IF) {
+        slots[0] = code->a;
+        return 1;
+    }
+    if (!is_value_op(code->op) || code->op == BC_SET_RI) {
+        return 0;
+    }
+    slots[0] = code->a;
+    if (is_immediate_form(code->op)) {
+        return 1;
+    }
+    slots[1] = code->b;
+    return 2;
+}
+
+// The compare opcode with its operands swapped: < becomes >, <= becomes >=
+static int mirror_compare(int op) {
+    int cmp = (op - BC_CMP_EQ_RR) / 2;
+    static const int mirrored[] = { CMP_EQ, CMP_NE, CMP_GT, CMP_GE, CMP_LT, CMP_LE };
+    return BC_CMP_EQ_RR + 2 * mirrored[cmp] + is_immediate_form(op);
+}
+
+// Mark the first instruction of every basic block
+static void mark_leaders(program_t* program, char* leader) {
+    build_cfg(program);
+    memset(leader, 0, program->compiled.count + 1);
+    for (int b = 0; b < program->block_count; b++) {
+        leader[program->blocks[b].start] = 1;
+    }
+}
+
+// Drop the instructions marked in removed, remapping branch targets past them
+static void compact(program_t* program, const char* removed) {
+    compiled_t* compiled = &program->compiled;
+    int* new_index = malloc(sizeof(int) * (compiled->count + 1));
+    int count = 0;
+    
+    // Every removal is optional, so without memory the code simply stays
+    if (!new_index) {
+        return;
+    }
+    
+    for (int i = 0; i < compiled->count; i++) {
+        new_index[i] = count;
+        if (!removed[i]) {
+            compiled->code[count] = compiled->code[i];
+            compiled->lines[count] = compiled->lines[i];
+            count++;
+        }
+    }
+    new_index[compiled->count] = count;
+    compiled->count = count;
+    
+    for (int i = 0; i < compiled->count; i++) {
+        bytecode_t* code = &compiled->code[i];
+        if (code->op == BC_IF || code->op == BC_GOTO) {
+            code->dst = new_index[code->dst];
+        }
+    }
+    free(new_index);
+}
+
+// Fold a set into the next instruction when that instruction overwrites the
+// same variable: set t x / add t t 1 becomes add t x 1
+static int merge_set(bytecode_t* set, bytecode_t* next) {
+    uint32_t t = set->dst;
+    
+    if (!is_value_op(next->op) || is_fused_branch(next->op) || next->dst != t) {
+        return 0;
+    }
+    
+    if (set->op == BC_SET_RR) {
+        if (next->a == t && (next->op != BC_SET_RI)) next->a = set->a;
+        if (next->b == t && !is_immediate_form(next->op)) next->b = set->a;
+        return 1;
+    }
+    
+    // set t imm: the value can only move into an immediate operand
+    int32_t imm = (int32_t)set->b;
+    int reads_a = next->op != BC_SET_RI && next->a == t;
+    int reads_b = next->op != BC_SET_RR && !is_immediate_form(next->op) && next->b == t;
+    
+    if (!reads_a && !reads_b) {
+        return 1; // Dead store
+    }
+    if (next->op == BC_SET_RR) {
+        next->op = BC_SET_RI;
+        next->b = (uint32_t)imm;
+        return 1;
+    }
+    if (is_immediate_form(next->op) || (reads_a && reads_b)) {
+        return 0;
+    }
+    if (next->op == BC_DIV_RR && imm == 0) {
+        return 0; // Keep the runtime division check
+    }
+    if (reads_a) {
+        if (is_compare(next->op)) {
+            next->op = mirror_compare(next->op);
+        } else if (!is_commutative(next->op)) {
+            return 0;
+        }
+        next->a = next->b;
+    }
+    next->op++; // The _RI form follows the _RR form
+    next->b = (uint32_t)imm;
+    return 1;
+}
+
+static void merge_sets(program_t* program, optimize_stats_t* stats) {
+    compiled_t* compiled = &program->compiled;
+    char* leader = malloc(compiled->count + 1);
+    char* removed = calloc(compiled->count + 1, 1);
+    
+    if (!leader || !removed) {
+        free(leader);
+        free(removed);
+        return;
+    }
+    mark_leaders(program, leader);
+    
+    for (int i = 0; i + 1 < compiled->count; i++) {
+        bytecode_t* code = &compiled->code[i];
+        
+        if ((code->op != BC_SET_RR && code->op != BC_SET_RI) || leader[i + 1]) {
+            continue;
+        }
+        if (merge_set(code, &compiled->code[i + 1])) {
+            removed[i] = 1;
+            stats->merged++;
+        }
+    }
+    
+    compact(program, removed);
+    free(leader);
+    free(removed);
+}
+
+static void remove_jumps_to_next(program_t* program, optimize_stats_t* stats) {
+    compiled_t* compiled = &program->compiled;
+    char* removed = malloc(compiled->count + 1);
+    int changed = 1;
+    
+    if (!removed) {
+        return;
+    }
+    
+    // Removing one jump can turn the jump before it into a jump to next
+    while (changed) {
+        changed = 0;
+        memset(removed, 0, compiled->count);
+        
+        for (int i = 0; i < compiled->count; i++) {
+            if (compiled->code[i].op == BC_GOTO && compiled->code[i].dst == (uint32_t)i + 1) {
+                removed[i] = 1;
+                stats->jumps_removed++;
+                changed = 1;
+            }
+        }
+        
+        compact(program, removed);
+    }
+    free(removed);
+}
+
+// Constant propagation tracks each variable as not yet seen, a known
+// constant, or varying
+typedef enum {
+    LATTICE_UNDEF,
+    LATTICE_CONST,
+    LATTICE_VARYING
+} lattice_state_t;
+
+typedef struct {
+    uint8_t state;
+    int64_t value;
+} lattice_t;
+
+// Entry state of every block, one row of variables per block. States and
+// values are kept apart so a cell takes 9 bytes rather than a padded 16.
+typedef struct {
+    uint8_t* state;
+    int64_t* value;
+} block_states_t;
+
+// Bound on block-by-variable cells kept by propagation, about 1 MB
+#define PROPAGATE_MAX_CELLS (1 << 17)
+
+static lattice_t slot_value(const program_t* program, const lattice_t* vars, uint32_t slot) {
+    lattice_t result = { LATTICE_VARYING, 0 };
+    
+    if (slot < (uint32_t)program->variable_count) {
+        result = vars[slot];
+        if (result.state == LATTICE_UNDEF) result.state = LATTICE_VARYING;
+    } else if (slot < (uint32_t)(program->variable_count + program->compiled.constant_count)) {
+        result.state = LATTICE_CONST;
+        result.value = program->compiled.constants[slot - program->variable_count];
+    }
+    return result;
+}
+
+// Evaluate a value operation at compile time, 0 if it must run (it may trap)
+static int fold(int op, int64_t a, int64_t b, int64_t* result) {
+    switch (op - is_immediate_form(op)) {
+        case BC_SET_RR: *result = is_immediate_form(op) ? b : a; return 1;
+        case BC_ADD_RR: *result = (int64_t)((uint64_t)a + (uint64_t)b); return 1;
+        case BC_SUB_RR: *result = (int64_t)((uint64_t)a - (uint64_t)b); return 1;
+        case BC_MUL_RR: *result = (int64_t)((uint64_t)a * (uint64_t)b); return 1;
+        case BC_DIV_RR:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return 0;
+            *result = a / b;
+            return 1;
+#define FOLD_COMPARE(name, op) case BC_CMP_##name##_RR: *result = a op b; return 1;
+        COMPARE_OPS(FOLD_COMPARE)
+#undef FOLD_COMPARE
+        default:
+            return 0;
+    }
+}
+
+// Abstract result of a value operation given the variables' lattice values
+static lattice_t evaluate(const program_t* program, const lattice_t* vars, const bytecode_t* code) {
+    lattice_t result = { LATTICE_VARYING, 0 };
+    lattice_t a = { LATTICE_CONST, 0 };
+    lattice_t b = { LATTICE_CONST, IMMEDIATE(code->b) };
+    
+    if (code->op != BC_SET_RI) {
+        a = slot_value(program, vars, code->a);
+    }
+    if (code->op != BC_SET_RR && !is_immediate_form(code->op)) {
+        b = slot_value(program, vars, code->b);
+    }
+    if (a.state == LATTICE_CONST && b.state == LATTICE_CONST && fold(code->op, a.value, b.value, &result.value)) {
+        result.state = LATTICE_CONST;
+    }
+    return result;
+}
+
+static void transfer(const program_t* program, lattice_t* vars, const bytecode_t* code) {
+    if (is_value_op(code->op)) {
+        vars[code->dst] = evaluate(program, vars, code);
+    }
+}
+
+static void load_entry(lattice_t* vars, const block_states_t* in, int b, int count) {
+    const uint8_t* state = &in->state[(size_t)b * count];
+    const int64_t* value = &in->value[(size_t)b * count];
+    
+    for (int i = 0; i < count; i++) {
+        vars[i].state = state[i];
+        vars[i].value = value[i];
+    }
+}
+
+// Merge a predecessor's exit state into a block's entry state
+static int meet_into(block_states_t* in, int b, const lattice_t* from, int count) {
+    uint8_t* state = &in->state[(size_t)b * count];
+    int64_t* value = &in->value[(size_t)b * count];
+    int changed = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (from[i].state == LATTICE_UNDEF || state[i] == LATTICE_VARYING) {
+            continue;
+        }
+        if (state[i] == LATTICE_UNDEF) {
+            state[i] = from[i].state;
+            value[i] = from[i].value;
+            changed = 1;
+        } else if (from[i].state == LATTICE_VARYING || from[i].value != value[i]) {
+            state[i] = LATTICE_VARYING;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+// Blocks control can reach from the end of block b given its exit state
+static int feasible_successors(const program_t* program, int b, const lattice_t* vars, int successors[2]) {
+    const compiled_t* compiled = &program->compiled;
+    const block_t* block = &program->blocks[b];
+    const bytecode_t* last = &compiled->code[block->end - 1];
+    int count = 0;
+    int jumps = 0;
+    int falls = 1;
+    
+    if (last->op == BC_GOTO) {
+        jumps = 1;
+        falls = 0;
+    } else if (last->op == BC_HALT) {
+        falls = 0;
+    } else if (last->op == BC_IF) {
+        lattice_t condition = slot_value(program, vars, last->a);
+        
+        jumps = condition.state != LATTICE_CONST || condition.value != 0;
+        falls = condition.state != LATTICE_CONST || condition.value == 0;
+    }
+    
+    if (jumps && last->dst < (uint32_t)compiled->count) {
+        successors[count++] = program->block_of[last->dst];
+    }
+    if (falls && block->end < compiled->count) {
+        successors[count++] = program->block_of[block->end];
+    }
+    return count;
+}
+
+// Point a variable operand that holds a known constant at a constant slot
+static void use_constant_slot(program_t* program, const lattice_t* vars, uint32_t* slot) {
+    lattice_t value = slot_value(program, vars, *slot);
+    
+    if (*slot < (uint32_t)program->variable_count && value.state == LATTICE_CONST) {
+        int constant = constant_slot(program, value.value);
+        if (constant != -1) {
+            *slot = constant;
+        }
+    }
+}
+
+// Rewrite one instruction using the constants known before it runs.
+// Returns 1 if the instruction should be removed.
+static int rewrite(program_t* program, const lattice_t* vars, bytecode_t* code, optimize_stats_t* stats) {
+    if (code->op == BC_IF) {
+        lattice_t condition = slot_value(program, vars, code->a);
+        
+        if (condition.state != LATTICE_CONST) {
+            return 0;
+        }
+        stats->branches_resolved++;
+        if (condition.value == 0) {
+            return 1;
+        }
+        code->op = BC_GOTO;
+        code->a = 0;
+        return 0;
+    }
+    
+    if (code->op == BC_OUT_R) {
+        use_constant_slot(program, vars, &code->a);
+        return 0;
+    }
+    
+    if (!is_value_op(code->op)) {
+        return 0;
+    }
+    
+    lattice_t result = evaluate(program, vars, code);
+    if (result.state == LATTICE_CONST) {
+        if (code->op == BC_SET_RI) {
+            return 0;
+        }
+        if (result.value >= INT32_MIN && result.value <= INT32_MAX) {
+            code->op = BC_SET_RI;
+            code->a = 0;
+            code->b = (uint32_t)(int32_t)result.value;
+        } else {
+            int constant = constant_slot(program, result.value);
+            if (constant == -1) {
+                return 0;
+            }
+            if (code->op == BC_SET_RR && code->a == (uint32_t)constant) {
+                return 0;
+            }
+            code->op = BC_SET_RR;
+            code->a = constant;
+        }
+        stats->folded++;
+        return 0;
+    }
+    
+    // Not foldable: still substitute whatever operands are known
+    if (code->op == BC_SET_RR || code->op == BC_SET_RI) {
+        return 0;
+    }
+    use_constant_slot(program, vars, &code->a);
+    if (is_immediate_form(code->op)) {
+        return 0;
+    }
+    use_constant_slot(program, vars, &code->b);
+    
+    lattice_t a = slot_value(program, vars, code->a);
+    lattice_t b = slot_value(program, vars, code->b);
+    int base = code->op;
+    
+    if (b.state == LATTICE_CONST && b.value >= INT32_MIN && b.value <= INT32_MAX && !(base == BC_DIV_RR && b.value == 0)) {
+        // A known divisor that is not zero drops the runtime check
+        code->op = base + 1;
+        code->b = (uint32_t)(int32_t)b.value;
+    } else if (a.state == LATTICE_CONST && a.value >= INT32_MIN && a.value <= INT32_MAX &&
+               (is_commutative(base) || is_compare(base))) {
+        code->op = (is_compare(base) ? mirror_compare(base) : base) + 1;
+        code->a = code->b;
+        code->b = (uint32_t)(int32_t)a.value;
+    }
+    return 0;
+}
+
+// Count a read of every variable when the host looks at them after a run
+static void observe_variables(const program_t* program, int* reads) {
+    if (program->variables_observed) {
+        for (int i = 0; i < program->variable_count; i++) {
+            reads[i]++;
+        }
+    }
+}
+
+// Remove value operations whose result no instruction reads
+static void remove_dead_stores(program_t* program, optimize_stats_t* stats) {
+    compiled_t* compiled = &program->compiled;
+    char* removed = malloc(compiled->count + 1);
+    int* reads = malloc(sizeof(int) * (compiled->slot_count + 1));
+    int changed = 1;
+    
+    if (!removed || !reads) {
+        changed = 0;
+    }
+    
+    while (changed) {
+        changed = 0;
+        memset(reads, 0, sizeof(int) * compiled->slot_count);
+        memset(removed, 0, compiled->count);
+        observe_variables(program, reads);
+        
+        for (int i = 0; i < compiled->count; i++) {
+            uint32_t slots[2];
+            int count = read_slots(&compiled->code[i], slots);
+            
+            for (int j = 0; j < count; j++) {
+                reads[slots[j]]++;
+            }
+        }
+        
+        for (int i = 0; i < compiled->count; i++) {
+            bytecode_t* code = &compiled->code[i];
+            int base = code->op - is_immediate_form(code->op);
+            
+            // Division stays: it can still fail at runtime
+            if (is_value_op(code->op) && base != BC_DIV_RR && reads[code->dst] == 0) {
+                removed[i] = 1;
+                stats->dead_removed++;
+                changed = 1;
+            }
+        }
+        
+        compact(program, removed);
+    }
+    free(removed);
+    free(reads);
+}
+
+// Conditional constant propagation over the CFG. Variables start at zero, so
+// the entry state is fully known; only feasible edges are followed, which
+// leaves unreachable blocks unvisited. Programs whose state would pass
+// PROPAGATE_MAX_CELLS only get dead stores removed.
+static void propagate_constants(program_t* program, optimize_stats_t* stats) {
+    compiled_t* compiled = &program->compiled;
+    int vars = program->variable_count;
+    
+    build_cfg(program);
+    int blocks = program->block_count;
+    
+    if (vars == 0) {
+        return;
+    }
+    if ((long)blocks * vars > PROPAGATE_MAX_CELLS) {
+        stats->propagation_skipped = 1;
+        remove_dead_stores(program, stats);
+        return;
+    }
+    
+    block_states_t in;
+    in.state = calloc((size_t)blocks * vars, sizeof(uint8_t));
+    in.value = calloc((size_t)blocks * vars, sizeof(int64_t));
+    lattice_t* current = malloc(sizeof(lattice_t) * vars);
+    int* worklist = malloc(sizeof(int) * blocks);
+    char* reached = calloc(blocks, 1);
+    char* queued = calloc(blocks, 1);
+    char* removed = calloc(compiled->count + 1, 1);
+    
+    if (!in.state || !in.value || !current || !worklist || !reached || !queued || !removed) {
+        free(in.state);
+        free(in.value);
+        free(current);
+        free(worklist);
+        free(reached);
+        free(queued);
+        free(removed);
+        stats->propagation_skipped = 1;
+        return;
+    }
+    
+    // Every variable starts at zero
+    memset(in.state, LATTICE_CONST, vars);
+    reached[0] = 1;
+    queued[0] = 1;
+    int pending = 1;
+    worklist[0] = 0;
+    
+    while (pending > 0) {
+        int b = worklist[--pending];
+        int successors[2];
+        queued[b] = 0;
+        
+        load_entry(current, &in, b, vars);
+        for (int i = program->blocks[b].start; i < program->blocks[b].end; i++) {
+            transfer(program, current, &compiled->code[i]);
+        }
+        
+        int count = feasible_successors(program, b, current, successors);
+        for (int s = 0; s < count; s++) {
+            int succ = successors[s];
+            int changed = meet_into(&in, succ, current, vars) || !reached[succ];
+            
+            reached[succ] = 1;
+            if (changed && !queued[succ]) {
+                queued[succ] = 1;
+                worklist[pending++] = succ;
+            }
+        }
+    }
+    
+    // Rewrite reachable code with the facts known at each instruction
+    for (int b = 0; b < blocks; b++) {
+        const block_t* block = &program->blocks[b];
+        
+        if (!reached[b]) {
+            for (int i = block->start; i < block->end; i++) {
+                removed[i] = 1;
+                stats->dead_removed++;
+            }
+            continue;
+        }
+        
+        load_entry(current, &in, b, vars);
+        for (int i = block->start; i < block->end; i++) {
+            bytecode_t* code = &compiled->code[i];
+            bytecode_t original = *code;
+            
+            removed[i] = rewrite(program, current, code, stats);
+            transfer(program, current, &original);
+        }
+    }
+    
+    free(in.state);
+    free(in.value);
+    free(current);
+    free(worklist);
+    free(reached);
+    free(queued);
+    
+    compact(program, removed);
+    free(removed);
+    remove_dead_stores(program, stats);
+}
+
+// Fuse cmp c a op b / if c goto l into one compare-and-branch. The if stays
+// in place as an extension word holding the target.
+static void fuse_compare_branches(program_t* program, optimize_stats_t* stats) {
+    compiled_t* compiled = &program->compiled;
+    char* leader = malloc(compiled->count + 1);
+    int* reads = malloc(sizeof(int) * (compiled->slot_count + 1));
+    
+    if (!leader || !reads) {
+        free(leader);
+        free(reads);
+        return;
+    }
+    mark_leaders(program, leader);
+    
+    for (int i = 0; i + 1 < compiled->count; i++) {
+        bytecode_t* code = &compiled->code[i];
+        bytecode_t* next = &compiled->code[i + 1];
+        
+        if (is_compare(code->op) && next->op == BC_IF && next->a == code->dst && !leader[i + 1]) {
+            code->op = code->op - BC_CMP_EQ_RR + BC_BR_EQ_RR;
+            stats->fused++;
+            i++;
+        }
+    }
+    
+    // A condition nobody else reads is written to the scratch slot instead
+    memset(reads, 0, sizeof(int) * compiled->slot_count);
+    observe_variables(program, reads);
+    for (int i = 0; i < compiled->count; i++) {
+        uint32_t slots[2];
+        int count = read_slots(&compiled->code[i], slots);
+        
+        for (int j = 0; j < count; j++) {
+            reads[slots[j]]++;
+        }
+        if (is_fused_branch(compiled->code[i].op)) {
+            i++; // The extension word is never executed
+        }
+    }
+    
+    int scratch = -1;
+    for (int i = 0; i < compiled->count; i++) {
+        bytecode_t* code = &compiled->code[i];
+        
+        if (is_fused_branch(code->op) && reads[code->dst] == 0) {
+            if (scratch == -1) {
+                scratch = compiled->slot_count++;
+            }
+            code->dst = scratch;
+        }
+    }
+    free(leader);
+    free(reads);
+}
+
+void optimize_program(program_t* program, int level, optimize_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    
+    if (level >= 2) {
+        propagate_constants(program, stats);
+    }
+    
+    if (level >= 1) {
+        merge_sets(program, stats);
+        remove_jumps_to_next(program, stats);
+        fuse_compare_branches(program, stats);
+    }
+    
+    build_cfg(program);
+}
\ No newline at end of file
@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#include "bareword.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define MAX_INTEGER_LENGTH 21   // "-9223372036854775808"
+
+// "00" to "99", so integers are formatted two digits per step
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+    
+static const struct {
+    const char* name;
+    flush_policy_t policy;
+} policies[] = {
+    { "line", FLUSH_LINE },
+    { "full", FLUSH_FULL },
+    { "exit", FLUSH_EXIT }
+};
+
+flush_policy_t find_flush_policy(const char* name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) {
+            return policies[i].policy;
+        }
+    }
+    return -1; // Unknown policy
+}
+
+static void stdio_write(void* user, const char* data, size_t size) {
+    (void)user;
+    fwrite(data, 1, size, stdout);
+    fflush(stdout);
+}
+
+static void stdio_error(void* user, int line, const char* message, span_t detail) {
+    (void)user;
+    
+    // Anything already on stdout comes before the error
+    fflush(stdout);
+    if (detail.length > 0) {
+        fprintf(stderr, "Error at line %d: %s \"%.*s\"\n", line, message, detail.length, detail.start);
+    } else {
+        fprintf(stderr, "Error at line %d: %s\n", line, message);
+    }
+}
+
+const sink_t stdio_sink = { stdio_write, stdio_error, NULL };
+
+flush_policy_t output_default_policy(void) {
+    // Interactive output shows up line by line, like stdio would
+    return isatty(fileno(stdout)) ? FLUSH_LINE : FLUSH_FULL;
+}
+
+void output_init(output_t* output, const sink_t* sink, flush_policy_t policy) {
+    output->sink = sink;
+    output->buffer = NULL;
+    output->capacity = 0;
+    output->used = 0;
+    output->policy = policy;
+    output->written = 0;
+}
+
+void output_free(output_t* output) {
+    free(output->buffer);
+    output->buffer = NULL;
+    output->capacity = 0;
+    output->used = 0;
+}
+
+static void output_write(output_t* output, const char* data, size_t size) {
+    output->sink->write(output->sink->user, data, size);
+    output->written += size;
+}
+
+void output_flush(output_t* output) {
+    if (output->used > 0) {
+        output_write(output, output->buffer, output->used);
+        output->used = 0;
+    }
+}
+
+// Make room for size more bytes, returns 0 if they still do not fit
+static int output_reserve(output_t* output, size_t size) {
+    if (output->capacity - output->used >= size) {
+        return 1;
+    }
+    if (!output->buffer) {
+        output->buffer = malloc(OUTPUT_BUFFER_SIZE);
+        if (output->buffer) {
+            output->capacity = OUTPUT_BUFFER_SIZE;
+            if (size <= output->capacity) {
+                return 1;
+            }
+        }
+    }
+    
+    // Deferred output keeps everything until exit if memory allows
+    if (output->policy == FLUSH_EXIT && output->buffer) {
+        size_t new_capacity = output->capacity * 2;
+        while (new_capacity - output->used < size) {
+            new_capacity *= 2;
+        }
+        
+        char* grown = realloc(output->buffer, new_capacity);
+        if (grown) {
+            output->buffer = grown;
+            output->capacity = new_capacity;
+            return 1;
+        }
+    }
+    
+    output_flush(output);
+    return output->capacity >= size;
+}
+
+void output_integer(output_t* output, int64_t value) {
+    char digits[MAX_INTEGER_LENGTH + 1];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    
+    // Work on the magnitude as unsigned so INT64_MIN negates cleanly
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    
+    *--p = '\n';
+    while (magnitude >= 100) {
+        const char* pair = &digit_pairs[(magnitude % 100) * 2];
+        magnitude /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (magnitude >= 10) {
+        const char* pair = &digit_pairs[magnitude * 2];
+        *--p = pair[1];
+        *--p = pair[0];
+    } else {
+        *--p = (char)('0' + magnitude);
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+    
+    size_t length = end - p;
+    if (output_reserve(output, length)) {
+        memcpy(output->buffer + output->used, p, length);
+        output->used += length;
+    } else {
+        // No buffer could be allocated
+        output_write(output, p, length);
+    }
+    
+    if (output->policy == FLUSH_LINE) {
+        output_flush(output);
+    }
+}
+
+void output_string(output_t* output, const char* str, size_t length) {
+    if (output_reserve(output, length + 1)) {
+        memcpy(output->buffer + output->used, str, length);
+        output->used += length;
+        output->buffer[output->used++] = '\n';
+    } else {
+        // Longer than the whole buffer, which output_reserve already flushed
+        output_write(output, str, length);
+        output_write(output, "\n", 1);
+    }
+    
+    if (output->policy == FLUSH_LINE) {
+        output_flush(output);
+    }
+}
\ No newline at end of file
@@ -1,207 +1,455 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "bareword.h"
 
-int parse_program(const char* filename, program_t* program) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
+#define READ_CHUNK_SIZE (64 * 1024)
+#define PARSE_SHARE_MIN (256 * 1024)    // Smallest share of the source worth a thread
+
+// Map the source read-only so tokens can point straight into it. Pipes,
+// empty files and anything else mmap refuses are read into the arena.
+int load_source(const char* filename, program_t* program) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    
+    if (fd < 0) {
+        return 0;
+    }
+    
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            program->source = data;
+            program->source_size = st.st_size;
+            program->source_mapped = 1;
+            close(fd);
+            return 1;
+        }
+    }
+    
+    char* data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    ssize_t count;
+    
+    do {
+        if (size == capacity) {
+            size_t new_capacity = capacity > 0 ? capacity * 2 : READ_CHUNK_SIZE;
+            char* grown = arena_grow(&program->arena, data, capacity, new_capacity);
+            if (!grown) {
+                close(fd);
+                return 0;
+            }
+            data = grown;
+            capacity = new_capacity;
+        }
+        count = read(fd, data + size, capacity - size);
+        if (count > 0) {
+            size += count;
+        }
+    } while (count > 0);
+    
+    close(fd);
+    program->source = data;
+    program->source_size = size;
+    return count == 0;
+}
+
+void init_program(program_t* program) {
+    memset(program, 0, sizeof(*program));
+    arena_init(&program->arena);
+    program->sink = &stdio_sink;
+}
+
+int load_program(const char* filename, program_t* program) {
+    init_program(program);
+    
+    if (!load_source(filename, program)) {
         fprintf(stderr, "Error: cannot open file '%s'\n", filename);
         return 0;
     }
+    return 1;
+}
+
+// Append the instruction on one tokenized line, checking its format
+int parse_line(program_t* program, const token_t tokens[], int token_count, int line_number) {
+    // First token must be an opcode
+    if (tokens[0].type != TOKEN_OPCODE) {
+        print_error_span(program->sink, line_number, "expected opcode at start of line", tokens[0].text);
+        return 0;
+    }
     
-    program->instruction_count = 0;
-    program->variable_count = 0;
-    program->label_count = 0;
+    // Parse instruction
+    instruction_t* instructions = arena_reserve(&program->arena, program->instructions,
+                                                program->instruction_count + 1,
+                                                &program->instruction_capacity, sizeof(instruction_t));
+    if (!instructions) {
+        print_error(program->sink, line_number, "out of memory", "");
+        return 0;
+    }
+    program->instructions = instructions;
     
-    char line[1024];
-    int line_number = 0;
+    instruction_t* inst = &program->instructions[program->instruction_count];
+    memset(inst, 0, sizeof(*inst));
+    inst->op = tokens[0].value;
+    inst->arg_count = token_count - 1;
+    inst->line_number = line_number;
     
-    while (fgets(line, sizeof(line), file)) {
-        line_number++;
-        
-        // Remove trailing newline
-        line[strcspn(line, "\n")] = '\0';
-        
-        // Skip empty lines and whitespace-only lines
-        char* trimmed = line;
-        while (isspace(*trimmed)) trimmed++;
-        if (strlen(trimmed) == 0) continue;
-        
+    // Arguments keep pointing into the source; extra ones are rejected below
+    for (int i = 1; i < token_count && i <= 4; i++) {
+        inst->args[i-1] = tokens[i].text;
+        inst->types[i-1] = tokens[i].type;
+    }
+    
+    // Validate instruction format
+    switch (inst->op) {
+        case OP_SET:
+            if (inst->arg_count != 2) {
+                print_error(program->sink, line_number, "set requires exactly 2 arguments", "set variable value");
+                return 0;
+            }
+            if (tokens[1].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "set requires variable name as first argument", tokens[1].text);
+                return 0;
+            }
+            if (tokens[2].type != TOKEN_INTEGER && tokens[2].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "set requires integer or variable as second argument", tokens[2].text);
+                return 0;
+            }
+            break;
+            
+        case OP_OUT:
+            if (inst->arg_count != 1) {
+                print_error(program->sink, line_number, "out requires exactly 1 argument", "out value");
+                return 0;
+            }
+            break;
+            
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            if (inst->arg_count != 3) {
+                print_error(program->sink, line_number, "arithmetic operations require exactly 3 arguments", "op result a b");
+                return 0;
+            }
+            if (tokens[1].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "result must be a variable name", tokens[1].text);
+                return 0;
+            }
+            break;
+            
+        case OP_CMP:
+            if (inst->arg_count != 4) {
+                print_error(program->sink, line_number, "cmp requires exactly 4 arguments", "cmp result a op b");
+                return 0;
+            }
+            if (tokens[1].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "result must be a variable name", tokens[1].text);
+                return 0;
+            }
+            if (tokens[3].type != TOKEN_COMPARISON) {
+                print_error_span(program->sink, line_number, "invalid comparison operator", tokens[3].text);
+                return 0;
+            }
+            inst->cmp = tokens[3].value;
+            break;
+            
+        case OP_IF:
+            if (inst->arg_count != 3) {
+                print_error(program->sink, line_number, "if requires exactly 3 arguments", "if condition goto label");
+                return 0;
+            }
+            if (tokens[1].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "condition must be a variable", tokens[1].text);
+                return 0;
+            }
+            if (tokens[2].type != TOKEN_OPCODE || tokens[2].value != OP_GOTO) {
+                print_error_span(program->sink, line_number, "if must be followed by 'goto'", tokens[2].text);
+                return 0;
+            }
+            if (tokens[3].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "goto requires a label name", tokens[3].text);
+                return 0;
+            }
+            break;
+            
+        case OP_GOTO:
+            if (inst->arg_count != 1) {
+                print_error(program->sink, line_number, "goto requires exactly 1 argument", "goto label");
+                return 0;
+            }
+            if (tokens[1].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "goto requires a label name", tokens[1].text);
+                return 0;
+            }
+            break;
+            
+        case OP_LABEL:
+            if (inst->arg_count != 1) {
+                print_error(program->sink, line_number, "label requires exactly 1 argument", "label name");
+                return 0;
+            }
+            if (tokens[1].type != TOKEN_IDENTIFIER) {
+                print_error_span(program->sink, line_number, "label requires a name", tokens[1].text);
+                return 0;
+            }
+            
+            // Register the label
+            label_t* labels = arena_reserve(&program->arena, program->labels, program->label_count + 1,
+                                            &program->label_capacity, sizeof(label_t));
+            if (!labels) {
+                print_error(program->sink, line_number, "out of memory", "");
+                return 0;
+            }
+            program->labels = labels;
+            
+            label_t* label = &program->labels[program->label_count];
+            label->name = inst->args[0];
+            label->instruction_index = program->instruction_count;
+            program->label_count++;
+            break;
+            
+        case OP_HALT:
+            if (inst->arg_count != 0) {
+                print_error(program->sink, line_number, "halt takes no arguments", "");
+                return 0;
+            }
+            break;
+            
+        case OP_INVALID:
+            print_error_span(program->sink, line_number, "invalid opcode", tokens[0].text);
+            return 0;
+    }
+    
+    program->instruction_count++;
+    return 1;
+}
+
+// Append the instructions of every line in text, numbering lines from 1
+static int parse_text(program_t* program, const char* text, size_t size) {
+    lexer_t lexer;
+    if (!lexer_init(&lexer, text, size, program->sink)) {
+        print_error(program->sink, 0, "out of memory", "");
+        return 0;
+    }
+    
+    while (!lexer_done(&lexer)) {
         // Tokenize the line
         token_t tokens[MAX_TOKENS_PER_LINE];
         int token_count;
         
-        if (!tokenize_line(trimmed, line_number, tokens, &token_count)) {
-            fclose(file);
+        if (!tokenize_line(&lexer, tokens, &token_count)) {
+            lexer_free(&lexer);
             return 0;
         }
+        int line_number = lexer.line_number;
         
+        // Skip empty and whitespace-only lines
         if (token_count == 0) continue;
         
-        // First token must be an opcode
-        if (tokens[0].type != TOKEN_OPCODE) {
-            print_error(line_number, "expected opcode at start of line", tokens[0].value);
-            fclose(file);
+        if (!parse_line(program, tokens, token_count, line_number)) {
+            lexer_free(&lexer);
             return 0;
         }
-        
-        // Parse instruction
-        instruction_t* inst = &program->instructions[program->instruction_count];
-        inst->op = string_to_opcode(tokens[0].value);
-        inst->arg_count = token_count - 1;
-        inst->line_number = line_number;
-        
-        // Copy arguments
-        for (int i = 1; i < token_count; i++) {
-            strncpy(inst->args[i-1], tokens[i].value, MAX_TOKEN_LENGTH - 1);
-            inst->args[i-1][MAX_TOKEN_LENGTH - 1] = '\0';
+    }
+    
+    lexer_free(&lexer);
+    return 1;
+}
+
+static void discard_write(void* user, const char* data, size_t size) {
+    (void)user;
+    (void)data;
+    (void)size;
+}
+
+static void discard_error(void* user, int line, const char* message, span_t detail) {
+    (void)user;
+    (void)line;
+    (void)message;
+    (void)detail;
+}
+
+// Workers parse quietly; a failed parse is repeated in order to report it
+static const sink_t discard_sink = { discard_write, discard_error, NULL };
+
+// One worker's share of the source, parsed into its own program and then
+// copied into place once every share's size is known
+typedef struct {
+    program_t* program;         // Program being built
+    program_t part;             // Instructions and labels of this share
+    const char* text;
+    size_t size;
+    int ok;
+    int line_base;              // Lines in the shares before this one
+    int instruction_base;
+    int label_base;
+} parse_share_t;
+
+static void* parse_share(void* arg) {
+    parse_share_t* share = arg;
+    
+    init_program(&share->part);
+    share->part.sink = &discard_sink;
+    share->ok = parse_text(&share->part, share->text, share->size);
+    return NULL;
+}
+
+// Move a share into the merged tables, renumbering lines and label targets
+static void* place_share(void* arg) {
+    parse_share_t* share = arg;
+    program_t* program = share->program;
+    instruction_t* instructions = program->instructions + share->instruction_base;
+    label_t* labels = program->labels + share->label_base;
+    
+    for (int i = 0; i < share->part.instruction_count; i++) {
+        instructions[i] = share->part.instructions[i];
+        instructions[i].line_number += share->line_base;
+    }
+    for (int i = 0; i < share->part.label_count; i++) {
+        labels[i] = share->part.labels[i];
+        labels[i].instruction_index += share->instruction_base;
+    }
+    free_program(&share->part);
+    return NULL;
+}
+
+// Run fn over every share, the first on the calling thread. A share whose
+// thread cannot be started runs on the calling thread too.
+static void run_shares(parse_share_t* shares, int count, void* (*fn)(void*)) {
+    pthread_t* threads = malloc(sizeof(pthread_t) * count);
+    int* started = calloc(count, sizeof(int));
+    
+    for (int i = 1; i < count; i++) {
+        started[i] = threads && started && pthread_create(&threads[i], NULL, fn, &shares[i]) == 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!started || !started[i]) {
+            fn(&shares[i]);
         }
-        
-        // Validate instruction format
-        switch (inst->op) {
-            case OP_SET:
-                if (inst->arg_count != 2) {
-                    print_error(line_number, "set requires exactly 2 arguments", "set variable value");
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[1].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "set requires variable name as first argument", tokens[1].value);
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[2].type != TOKEN_INTEGER && tokens[2].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "set requires integer or variable as second argument", tokens[2].value);
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_OUT:
-                if (inst->arg_count != 1) {
-                    print_error(line_number, "out requires exactly 1 argument", "out value");
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_ADD:
-            case OP_SUB:
-            case OP_MUL:
-            case OP_DIV:
-                if (inst->arg_count != 3) {
-                    print_error(line_number, "arithmetic operations require exactly 3 arguments", "op result a b");
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[1].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "result must be a variable name", tokens[1].value);
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_CMP:
-                if (inst->arg_count != 4) {
-                    print_error(line_number, "cmp requires exactly 4 arguments", "cmp result a op b");
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[1].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "result must be a variable name", tokens[1].value);
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[3].type != TOKEN_COMPARISON) {
-                    print_error(line_number, "invalid comparison operator", tokens[3].value);
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_IF:
-                if (inst->arg_count != 3) {
-                    print_error(line_number, "if requires exactly 3 arguments", "if condition goto label");
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[1].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "condition must be a variable", tokens[1].value);
-                    fclose(file);
-                    return 0;
-                }
-                if (strcmp(tokens[2].value, "goto") != 0) {
-                    print_error(line_number, "if must be followed by 'goto'", tokens[2].value);
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[3].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "goto requires a label name", tokens[3].value);
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_GOTO:
-                if (inst->arg_count != 1) {
-                    print_error(line_number, "goto requires exactly 1 argument", "goto label");
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[1].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "goto requires a label name", tokens[1].value);
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_LABEL:
-                if (inst->arg_count != 1) {
-                    print_error(line_number, "label requires exactly 1 argument", "label name");
-                    fclose(file);
-                    return 0;
-                }
-                if (tokens[1].type != TOKEN_IDENTIFIER) {
-                    print_error(line_number, "label requires a name", tokens[1].value);
-                    fclose(file);
-                    return 0;
-                }
-                
-                // Register the label
-                if (program->label_count >= MAX_LABELS) {
-                    print_error(line_number, "too many labels", "");
-                    fclose(file);
-                    return 0;
-                }
-                
-                label_t* label = &program->labels[program->label_count];
-                strncpy(label->name, tokens[1].value, MAX_TOKEN_LENGTH - 1);
-                label->name[MAX_TOKEN_LENGTH - 1] = '\0';
-                label->instruction_index = program->instruction_count;
-                program->label_count++;
-                break;
-                
-            case OP_HALT:
-                if (inst->arg_count != 0) {
-                    print_error(line_number, "halt takes no arguments", "");
-                    fclose(file);
-                    return 0;
-                }
-                break;
-                
-            case OP_INVALID:
-                print_error(line_number, "invalid opcode", tokens[0].value);
-                fclose(file);
-                return 0;
+    }
+    for (int i = 1; i < count; i++) {
+        if (started && started[i]) {
+            pthread_join(threads[i], NULL);
         }
+    }
+    free(threads);
+    free(started);
+}
+
+// Split the source at line boundaries into count shares of about equal
+// size and parse them side by side. Labels are only collected here; the
+// validator checks for duplicates over the merged table. Returns 0 if any
+// share failed, leaving the program untouched.
+static int parse_parallel(program_t* program, int count) {
+    parse_share_t* shares = calloc(count, sizeof(parse_share_t));
+    const char* text = program->source;
+    size_t size = program->source_size;
+    size_t start = 0;
+    int n = 0;
+    
+    if (!shares) {
+        return 0;
+    }
+    while (start < size && n < count) {
+        size_t end = n == count - 1 ? size : size / count * (n + 1);
+        if (end <= start) {
+            end = start;
+        }
+        const char* newline = end < size ? memchr(text + end, '\n', size - end) : NULL;
+        end = newline ? (size_t)(newline - text) + 1 : size;
         
-        program->instruction_count++;
-        
-        if (program->instruction_count >= MAX_LINES) {
-            print_error(line_number, "program too long", "");
-            fclose(file);
-            return 0;
+        shares[n].program = program;
+        shares[n].text = text + start;
+        shares[n].size = end - start;
+        n++;
+        start = end;
+    }
+    run_shares(shares, n, parse_share);
+    
+    // Lay the shares out one after another
+    int ok = 1;
+    int lines = 0;
+    int instructions = 0;
+    int labels = 0;
+    for (int i = 0; i < n; i++) {
+        ok = ok && shares[i].ok;
+        shares[i].line_base = lines;
+        shares[i].instruction_base = instructions;
+        shares[i].label_base = labels;
+        for (const char* p = shares[i].text; (p = memchr(p, '\n', shares[i].text + shares[i].size - p)); p++) {
+            lines++;
         }
+        instructions += shares[i].part.instruction_count;
+        labels += shares[i].part.label_count;
     }
     
-    fclose(file);
-    return 1;
+    if (ok) {
+        program->instructions = arena_reserve(&program->arena, NULL, instructions, &program->instruction_capacity,
+                                              sizeof(instruction_t));
+        program->labels = arena_reserve(&program->arena, NULL, labels, &program->label_capacity, sizeof(label_t));
+        ok = program->instructions && program->labels;
+    }
+    if (ok) {
+        program->instruction_count = instructions;
+        program->label_count = labels;
+        run_shares(shares, n, place_share);
+    } else {
+        program->instructions = NULL;
+        program->instruction_capacity = 0;
+        program->labels = NULL;
+        program->label_capacity = 0;
+        for (int i = 0; i < n; i++) {
+            free_program(&shares[i].part);
+        }
+    }
+    free(shares);
+    return ok;
+}
+
+// Build the instruction list from the loaded source text. Large sources are
+// parsed by up to jobs threads, 0 meaning one per online CPU, with at least
+// PARSE_SHARE_MIN bytes each.
+int parse_source_jobs(program_t* program, int jobs) {
+    if (program->source_size >= UINT32_MAX) {
+        print_error(program->sink, 0, "source file too large", "");
+        return 0;
+    }
+    
+    if (jobs <= 0) {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    size_t shares = program->source_size / PARSE_SHARE_MIN;
+    if ((size_t)jobs > shares) {
+        jobs = (int)shares;
+    }
+    
+    // Any error is found again in order, to report it as a sequential parse would
+    if (jobs > 1 && parse_parallel(program, jobs)) {
+        return 1;
+    }
+    return parse_text(program, program->source, program->source_size);
+}
+
+int parse_source(program_t* program) {
+    return parse_source_jobs(program, 0);
+}
+
+int parse_program(const char* filename, program_t* program) {
+    return load_program(filename, program) && parse_source(program);
+}
+
+void free_program(program_t* program) {
+    if (program->source_mapped) {
+        munmap((void*)program->source, program->source_size);
+    }
+    if (program->image) {
+        munmap((void*)program->image, program->image_size);
+    }
+    arena_free(&program->arena);
+    memset(program, 0, sizeof(*program));
 }
\ No newline at end of file
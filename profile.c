@@ -0,0 +1,227 @@
+#include "bareword.h"
+
+/*
+ * Reports over the counters of the profiling engine (--profile). Counters
+ * are per lowered instruction; both reports add them up per source line,
+ * so a line reads the same at every optimization level, minus whatever the
+ * optimizer removed.
+ */
+ 
+typedef struct {
+    int line;
+    uint64_t count;             // Instructions executed on the line
+    uint64_t ticks;
+    uint64_t branches;          // Executions of an if on the line
+    uint64_t taken;
+} line_profile_t;
+
+// Lines in order of time spent, then executions
+static int compare_hotness(const void* a, const void* b) {
+    const line_profile_t* x = a;
+    const line_profile_t* y = b;
+    
+    if (x->ticks != y->ticks) {
+        return x->ticks < y->ticks ? 1 : -1;
+    }
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->line - y->line;
+}
+
+// One entry per executed source line, hottest first; NULL without memory
+static line_profile_t* collect_lines(const program_t* program, const profile_t* profile, int* line_count) {
+    const compiled_t* compiled = &program->compiled;
+    int max_line = 0;
+    
+    for (int pc = 0; pc < profile->count; pc++) {
+        if (compiled->lines[pc] > max_line) {
+            max_line = compiled->lines[pc];
+        }
+    }
+    
+    line_profile_t* lines = calloc(max_line + 1, sizeof(line_profile_t));
+    if (!lines) {
+        return NULL;
+    }
+    for (int pc = 0; pc < profile->count; pc++) {
+        line_profile_t* line = &lines[compiled->lines[pc]];
+        
+        line->count += profile->counts[pc];
+        line->ticks += profile->ticks[pc];
+        if (compiled->code[pc].op == BC_IF) {
+            line->branches += profile->counts[pc];
+            line->taken += profile->taken[pc];
+        }
+    }
+    
+    int count = 0;
+    for (int i = 0; i <= max_line; i++) {
+        if (lines[i].count > 0) {
+            lines[count] = lines[i];
+            lines[count].line = i;
+            count++;
+        }
+    }
+    qsort(lines, count, sizeof(line_profile_t), compare_hotness);
+    *line_count = count;
+    return lines;
+}
+
+// Start of every source line, 1-based, with one entry past the last line
+const char** index_source(const program_t* program, int* line_count) {
+    const char* text = program->source;
+    size_t size = program->source_size;
+    int count = 1;
+    
+    if (!text) {
+        return NULL; // A bytecode image run without its source
+    }
+    for (size_t i = 0; i < size; i++) {
+        count += text[i] == '\n';
+    }
+    
+    const char** starts = malloc(sizeof(char*) * (count + 2));
+    if (!starts) {
+        return NULL;
+    }
+    int line = 1;
+    starts[line] = text;
+    for (size_t i = 0; i < size; i++) {
+        if (text[i] == '\n') {
+            starts[++line] = &text[i + 1];
+        }
+    }
+    starts[line + 1] = text + size;
+    *line_count = line;
+    return starts;
+}
+
+// Source text of a line, without indentation or line ending
+span_t line_text(const char** starts, int line_count, int line) {
+    span_t text = { NULL, 0 };
+    
+    if (!starts || line < 1 || line > line_count) {
+        return text;
+    }
+    const char* start = starts[line];
+    const char* end = starts[line + 1];
+    
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    text.start = start;
+    text.length = (int)(end - start);
+    return text;
+}
+
+static uint64_t total_ticks(const profile_t* profile, uint64_t* executed) {
+    uint64_t ticks = 0;
+    
+    *executed = 0;
+    for (int pc = 0; pc < profile->count; pc++) {
+        ticks += profile->ticks[pc];
+        *executed += profile->counts[pc];
+    }
+    return ticks;
+}
+
+// Annotated listing of the executed lines, hottest first
+void print_profile(const program_t* program, const profile_t* profile, FILE* out) {
+    int line_count = 0;
+    int source_lines = 0;
+    line_profile_t* lines = collect_lines(program, profile, &line_count);
+    const char** starts = index_source(program, &source_lines);
+    uint64_t executed;
+    uint64_t ticks = total_ticks(profile, &executed);
+    
+    if (!lines) {
+        free(starts);
+        fprintf(out, "Profile: out of memory\n");
+        return;
+    }
+    
+    fprintf(out, "\nProfile: %llu instructions executed, %llu %s\n\n",
+            (unsigned long long)executed, (unsigned long long)ticks, profile->clock);
+    fprintf(out, "  %%Time  %14s  %12s  %6s  %6s  Source\n", profile->clock, "Count", "Taken", "Line");
+    for (int i = 0; i < line_count; i++) {
+        const line_profile_t* line = &lines[i];
+        span_t text = line_text(starts, source_lines, line->line);
+        char taken[16] = "";
+        
+        if (line->branches > 0) {
+            snprintf(taken, sizeof(taken), "%.1f%%", 100.0 * line->taken / line->branches);
+        }
+        fprintf(out, "%6.1f%%  %14llu  %12llu  %6s  %6d  %.*s\n",
+                ticks > 0 ? 100.0 * line->ticks / ticks : 0.0, (unsigned long long)line->ticks,
+                (unsigned long long)line->count, taken, line->line, text.length, text.start ? text.start : "");
+    }
+    
+    free(lines);
+    free(starts);
+}
+
+static void write_json_string(const char* text, size_t length, FILE* out) {
+    fputc('"', out);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7F) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// The same data for tools: totals, every executed line hottest first, and
+// the raw counters of every instruction
+int write_profile_json(const program_t* program, const profile_t* profile, const char* source_name, FILE* out) {
+    int line_count = 0;
+    int source_lines = 0;
+    line_profile_t* lines = collect_lines(program, profile, &line_count);
+    const char** starts = index_source(program, &source_lines);
+    uint64_t executed;
+    uint64_t ticks = total_ticks(profile, &executed);
+    
+    if (!lines) {
+        free(starts);
+        return 0;
+    }
+    
+    fputs("{\n  \"source\": ", out);
+    write_json_string(source_name, strlen(source_name), out);
+    fprintf(out, ",\n  \"clock\": \"%s\",\n", profile->clock);
+    fprintf(out, "  \"executed\": %llu,\n", (unsigned long long)executed);
+    fprintf(out, "  \"ticks\": %llu,\n", (unsigned long long)ticks);
+    
+    fputs("  \"lines\": [", out);
+    for (int i = 0; i < line_count; i++) {
+        const line_profile_t* line = &lines[i];
+        span_t text = line_text(starts, source_lines, line->line);
+        
+        fprintf(out, "%s\n    {\"line\": %d, \"count\": %llu, \"ticks\": %llu, \"branches\": %llu, \"taken\": %llu, "
+                "\"text\": ", i > 0 ? "," : "", line->line, (unsigned long long)line->count,
+                (unsigned long long)line->ticks, (unsigned long long)line->branches,
+                (unsigned long long)line->taken);
+        write_json_string(text.start ? text.start : "", text.length, out);
+        fputc('}', out);
+    }
+    fputs("\n  ],\n", out);
+    
+    fputs("  \"instructions\": [", out);
+    for (int pc = 0; pc < profile->count; pc++) {
+        fprintf(out, "%s\n    {\"pc\": %d, \"line\": %d, \"op\": %d, \"count\": %llu, \"ticks\": %llu, \"taken\": %llu}",
+                pc > 0 ? "," : "", pc, program->compiled.lines[pc], program->compiled.code[pc].op,
+                (unsigned long long)profile->counts[pc], (unsigned long long)profile->ticks[pc],
+                (unsigned long long)profile->taken[pc]);
+    }
+    fputs("\n  ]\n}\n", out);
+    
+    free(lines);
+    free(starts);
+    fflush(out);
+    return !ferror(out);
+}
\ No newline at end of file
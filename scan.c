@@ -0,0 +1,231 @@
+#include "bareword.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+#define SCAN_BLOCK 64
+
+/*
+ * Structural scanner. The source is classified 64 bytes at a time into
+ * bitmasks of separators, newlines and quotes, from which the offsets of
+ * every token start, token end, quote and newline are extracted in order.
+ * The tokenizer walks that index instead of looking at every byte.
+ *
+ * Each kernel fills masks[SCAN_SEPARATORS], masks[SCAN_NEWLINES] and
+ * masks[SCAN_QUOTES] for one 64-byte block, bit i standing for byte i.
+ */
+ 
+enum { SCAN_SEPARATORS, SCAN_NEWLINES, SCAN_QUOTES };
+
+typedef void (*scan_block_fn)(const char* block, uint64_t masks[3]);
+
+static void scan_block_scalar(const char* block, uint64_t masks[3]) {
+    masks[SCAN_SEPARATORS] = 0;
+    masks[SCAN_NEWLINES] = 0;
+    masks[SCAN_QUOTES] = 0;
+    
+    for (int i = 0; i < SCAN_BLOCK; i++) {
+        char c = block[i];
+        uint64_t bit = (uint64_t)1 << i;
+        
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') masks[SCAN_SEPARATORS] |= bit;
+        if (c == '\n') masks[SCAN_NEWLINES] |= bit;
+        if (c == '"') masks[SCAN_QUOTES] |= bit;
+    }
+}
+
+#if SCAN_X86
+__attribute__((target("sse2")))
+static void scan_block_sse2(const char* block, uint64_t masks[3]) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i quote = _mm_set1_epi8('"');
+    
+    masks[SCAN_SEPARATORS] = 0;
+    masks[SCAN_NEWLINES] = 0;
+    masks[SCAN_QUOTES] = 0;
+    
+    for (int i = 0; i < SCAN_BLOCK; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(block + i));
+        __m128i nl = _mm_cmpeq_epi8(bytes, newline);
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(bytes, cr), nl));
+                                  
+        masks[SCAN_SEPARATORS] |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+        masks[SCAN_NEWLINES] |= (uint64_t)(uint16_t)_mm_movemask_epi8(nl) << i;
+        masks[SCAN_QUOTES] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void scan_block_avx2(const char* block, uint64_t masks[3]) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i quote = _mm256_set1_epi8('"');
+    
+    masks[SCAN_SEPARATORS] = 0;
+    masks[SCAN_NEWLINES] = 0;
+    masks[SCAN_QUOTES] = 0;
+    
+    for (int i = 0; i < SCAN_BLOCK; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(block + i));
+        __m256i nl = _mm256_cmpeq_epi8(bytes, newline);
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), _mm256_cmpeq_epi8(bytes, tab)),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(bytes, cr), nl));
+                                     
+        masks[SCAN_SEPARATORS] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+        masks[SCAN_NEWLINES] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(nl) << i;
+        masks[SCAN_QUOTES] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quote)) << i;
+    }
+}
+#endif
+
+static int supports(const char* feature) {
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(feature, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(feature, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(feature, "scalar") == 0;
+}
+
+// Fastest first, the first one the CPU supports is the default
+static const struct {
+    const char* name;
+    scan_block_fn scan;
+} scanners[] = {
+#if SCAN_X86
+    { "avx2", scan_block_avx2 },
+    { "sse2", scan_block_sse2 },
+#endif
+    { "scalar", scan_block_scalar }
+};
+
+// Only written by select_scanner(), which hosts call before scanning starts;
+// scanners otherwise take the fastest kernel without touching shared state
+static int selected = -1;
+
+static int find_scanner(const char* name) {
+    for (size_t i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+        if ((!name || strcmp(scanners[i].name, name) == 0) && supports(scanners[i].name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int select_scanner(const char* name) {
+    int kernel = find_scanner(name);
+    
+    if (kernel < 0) {
+        return 0;
+    }
+    selected = kernel;
+    return 1;
+}
+
+const char* scanner_name(void) {
+    return scanners[selected >= 0 ? selected : find_scanner(NULL)].name;
+}
+
+static int lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+static int bit_count(uint64_t bits) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(bits);
+#else
+    int count = 0;
+    for (; bits; bits &= bits - 1) count++;
+    return count;
+#endif
+}
+
+int scanner_init(scanner_t* scanner, const char* text, size_t size) {
+    scanner->text = text;
+    scanner->size = size;
+    scanner->position = 0;
+    scanner->in_token = 0;
+    scanner->finished = 0;
+    scanner->count = 0;
+    scanner->kernel = selected >= 0 ? selected : find_scanner(NULL);
+    scanner->index = malloc(sizeof(uint32_t) * (SCAN_WINDOW + SCAN_BLOCK + 1));
+    return scanner->index != NULL;
+}
+
+void scanner_free(scanner_t* scanner) {
+    free(scanner->index);
+    scanner->index = NULL;
+}
+
+// Index the next window of the source, returns the number of entries
+size_t scan_window(scanner_t* scanner) {
+    scan_block_fn scan = scanners[scanner->kernel].scan;
+    size_t size = scanner->size;
+    size_t end = size - scanner->position > SCAN_WINDOW ? scanner->position + SCAN_WINDOW : size;
+    uint32_t* index = scanner->index;
+    size_t count = 0;
+    char tail[SCAN_BLOCK];
+    
+    for (size_t base = scanner->position; base < end; base += SCAN_BLOCK) {
+        const char* block = scanner->text + base;
+        uint64_t valid = ~(uint64_t)0;
+        uint64_t masks[3];
+        
+        // The last partial block is padded with separators
+        if (size - base < SCAN_BLOCK) {
+            memset(tail, ' ', SCAN_BLOCK);
+            memcpy(tail, block, size - base);
+            block = tail;
+            valid = ((uint64_t)1 << (size - base)) - 1;
+        }
+        scan(block, masks);
+        
+        // A token starts where a non-separator follows a separator and ends
+        // at the first separator after it
+        uint64_t in_token = ~masks[SCAN_SEPARATORS];
+        uint64_t follows_token = (in_token << 1) | scanner->in_token;
+        uint64_t starts = in_token & ~follows_token;
+        uint64_t ends = masks[SCAN_SEPARATORS] & follows_token;
+        uint64_t bits = (starts | ends | masks[SCAN_NEWLINES] | masks[SCAN_QUOTES]) & valid;
+        scanner->in_token = in_token >> 63;
+        
+        // Extract eight offsets at a time without a data-dependent branch per
+        // offset; stray writes past the last one land in the window's slack
+        int found = bit_count(bits);
+        for (int written = 0; written < found; written += 8) {
+            for (int i = 0; i < 8; i++) {
+                index[count + written + i] = base + lowest_bit(bits | (uint64_t)1 << 63);
+                bits &= bits - 1;
+            }
+        }
+        count += found;
+    }
+    
+    scanner->position = end;
+    if (end == size && !scanner->finished) {
+        // The end of the source ends the last line
+        index[count++] = size;
+        scanner->finished = 1;
+    }
+    scanner->count = count;
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,524 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <unistd.h>
+#include "bareword.h"
+
+#define STREAM_READ_SIZE (64 * 1024)
+#define STEP_PAGE_BITS 12
+#define STEP_PAGE_SIZE (1 << STEP_PAGE_BITS)
+#define STEP_PAGES 65536            // Directory entries, fixed so pages never move
+#define STREAM_POLL_JUMPS 65536     // Jumps between checks for a failed producer
+
+// Validated instruction as the streaming executor runs it. Operands are
+// variable slots or, where the literal bit is set, the value itself.
+typedef struct {
+    uint8_t op;             // opcode_t
+    uint8_t cmp;            // comparison_t of a cmp
+    uint8_t literal;        // Bit per operand holding a value rather than a slot
+    int line;
+    int target;             // Branch target step, -1 until its label is found
+    int64_t operand[3];     // Destination, then the sources
+    span_t text;            // String of an out, label name of a branch
+} step_t;
+
+// Shared between the thread parsing the input and the one running it. The
+// producer owns program and appends steps; everything the executor reads
+// beyond the published steps is read under the lock.
+typedef struct {
+    program_t program;
+    int fd;
+    step_t* pages[STEP_PAGES];
+    int step_count;             // Steps parsed so far
+    int has_halt;
+    int errors;                 // Validation errors reported
+    int parse_failed;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t progress;    // Signalled whenever more of the program is known
+    int published;              // Steps the executor may run
+    int variables;              // Variable count matching them
+    int finished;               // The whole input has been read
+    int failed;                 // The program cannot run to completion
+} stream_t;
+
+static step_t* step_at(step_t* const* pages, int index) {
+    return &pages[index >> STEP_PAGE_BITS][index & (STEP_PAGE_SIZE - 1)];
+}
+
+// Operand k of step from argument arg of inst
+static void step_operand(step_t* step, const instruction_t* inst, int k, int arg) {
+    if (inst->slots[arg] != -1) {
+        step->operand[k] = inst->slots[arg];
+    } else {
+        step->operand[k] = parse_integer(inst->args[arg]);
+        step->literal |= 1 << k;
+    }
+}
+
+// Turn a parsed instruction into the next step, or a label into a position
+static int add_step(stream_t* stream, const instruction_t* inst) {
+    program_t* program = &stream->program;
+    
+    if (inst->op == OP_LABEL) {
+        // Branches land on the step after the label
+        int label = program->label_count - 1;
+        program->labels[label].instruction_index = stream->step_count;
+        int added = index_label(program, label);
+        if (added == -1) {
+            print_error(program->sink, inst->line_number, "out of memory", "");
+            return 0;
+        }
+        if (!added) {
+            // Reported without a line, as the validator does for a file
+            print_error_span(program->sink, 0, "duplicate label", inst->args[0]);
+            stream->errors++;
+        }
+        return 1;
+    }
+    
+    int index = stream->step_count;
+    if (index >> STEP_PAGE_BITS >= STEP_PAGES) {
+        print_error(program->sink, inst->line_number, "program too large", "");
+        return 0;
+    }
+    if ((index & (STEP_PAGE_SIZE - 1)) == 0) {
+        stream->pages[index >> STEP_PAGE_BITS] = malloc(sizeof(step_t) * STEP_PAGE_SIZE);
+        if (!stream->pages[index >> STEP_PAGE_BITS]) {
+            print_error(program->sink, inst->line_number, "out of memory", "");
+            return 0;
+        }
+    }
+    
+    step_t* step = step_at(stream->pages, index);
+    memset(step, 0, sizeof(*step));
+    step->op = inst->op;
+    step->cmp = inst->cmp;
+    step->line = inst->line_number;
+    step->target = -1;
+    
+    switch (inst->op) {
+        case OP_SET:
+            step_operand(step, inst, 0, 0);
+            step_operand(step, inst, 1, 1);
+            break;
+            
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            step_operand(step, inst, 0, 0);
+            step_operand(step, inst, 1, 1);
+            step_operand(step, inst, 2, 2);
+            break;
+            
+        case OP_CMP:
+            step_operand(step, inst, 0, 0);
+            step_operand(step, inst, 1, 1);
+            step_operand(step, inst, 2, 3);
+            break;
+            
+        case OP_OUT:
+            if (is_text_operand(inst)) {
+                step->text = inst->args[0];
+            } else {
+                step_operand(step, inst, 1, 0);
+            }
+            break;
+            
+        case OP_IF:
+            step_operand(step, inst, 1, 0);
+            step->text = inst->args[2];
+            break;
+            
+        case OP_GOTO:
+            step->text = inst->args[0];
+            break;
+            
+        case OP_HALT:
+            stream->has_halt = 1;
+            break;
+            
+        default:
+            break;
+    }
+    
+    // Backward branches resolve at once, forward ones when first taken
+    if (step->text.start && inst->op != OP_OUT) {
+        step->target = find_label(program, step->text);
+    }
+    stream->step_count++;
+    return 1;
+}
+
+// Parse and validate a run of complete lines, the first numbered line + 1
+static int parse_chunk(stream_t* stream, const char* text, size_t size, int line) {
+    program_t* program = &stream->program;
+    lexer_t lexer;
+    
+    if (!lexer_init(&lexer, text, size, program->sink)) {
+        print_error(program->sink, line, "out of memory", "");
+        return 0;
+    }
+    lexer.line_number = line;
+    
+    while (!lexer_done(&lexer)) {
+        token_t tokens[MAX_TOKENS_PER_LINE];
+        int token_count;
+        
+        if (!tokenize_line(&lexer, tokens, &token_count)) {
+            lexer_free(&lexer);
+            stream->parse_failed = 1;
+            return 0;
+        }
+        if (token_count == 0) continue;
+        
+        // One instruction at a time: the table only ever holds this one
+        program->instruction_count = 0;
+        if (!parse_line(program, tokens, token_count, lexer.line_number)) {
+            lexer_free(&lexer);
+            stream->parse_failed = 1;
+            return 0;
+        }
+        
+        instruction_t* inst = &program->instructions[0];
+        int found = validate_instruction(program, inst);
+        if (found == -1 || !add_step(stream, inst)) {
+            lexer_free(&lexer);
+            return 0;
+        }
+        stream->errors += found;
+    }
+    
+    lexer_free(&lexer);
+    return 1;
+}
+
+// Checks that need the whole program: every branch names a label and
+// something halts
+static void finish_program(stream_t* stream) {
+    program_t* program = &stream->program;
+    
+    for (int i = 0; i < stream->step_count; i++) {
+        const step_t* step = step_at(stream->pages, i);
+        
+        if ((step->op == OP_IF || step->op == OP_GOTO) && find_label(program, step->text) == -1) {
+            print_error_span(program->sink, step->line, "undefined label", step->text);
+            stream->errors++;
+        }
+    }
+    if (!stream->has_halt) {
+        print_error(program->sink, 0, "program must contain at least one 'halt' instruction", "");
+        stream->errors++;
+    }
+}
+
+// Let the executor run everything parsed so far
+static void publish(stream_t* stream, int finished, int ok) {
+    pthread_mutex_lock(&stream->lock);
+    stream->published = stream->step_count;
+    stream->variables = stream->program.variable_count;
+    if (!ok || stream->errors > 0) {
+        stream->failed = 1;
+    }
+    stream->finished = finished;
+    pthread_cond_broadcast(&stream->progress);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// Producer: read the input, parsing every complete line as soon as it
+// arrives. Each run of lines is copied into the program arena, where the
+// spans of the steps made from it stay valid.
+static void* parse_stream(void* arg) {
+    stream_t* stream = arg;
+    program_t* program = &stream->program;
+    char* buffer = malloc(STREAM_READ_SIZE);
+    size_t capacity = STREAM_READ_SIZE;
+    size_t used = 0;
+    int line = 0;
+    int ok = buffer != NULL;
+    ssize_t count = 1;
+    
+    while (ok && count > 0) {
+        if (used == capacity) {
+            char* grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                print_error(program->sink, line, "out of memory", "");
+                ok = 0;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        count = read(stream->fd, buffer + used, capacity - used);
+        if (count < 0) {
+            print_error(program->sink, 0, "cannot read program", "");
+            ok = 0;
+            break;
+        }
+        used += count;
+        
+        // Everything up to the last newline, or the unterminated tail at the end
+        size_t size = used;
+        if (count > 0) {
+            while (size > 0 && buffer[size - 1] != '\n') {
+                size--;
+            }
+        }
+        if (size == 0) {
+            continue;
+        }
+        
+        char* text = arena_alloc(&program->arena, size);
+        if (!text) {
+            print_error(program->sink, line, "out of memory", "");
+            ok = 0;
+            break;
+        }
+        memcpy(text, buffer, size);
+        memmove(buffer, buffer + size, used - size);
+        used -= size;
+        
+        // The lexer reads a trailing newline as ending one more empty line
+        pthread_mutex_lock(&stream->lock);
+        ok = parse_chunk(stream, text, size, line);
+        pthread_mutex_unlock(&stream->lock);
+        for (size_t i = 0; i < size; i++) {
+            line += text[i] == '\n';
+        }
+        if (ok && count > 0) {
+            publish(stream, 0, 1);
+        }
+    }
+    
+    if (!buffer) {
+        print_error(program->sink, 0, "out of memory", "");
+    }
+    free(buffer);
+    
+    pthread_mutex_lock(&stream->lock);
+    if (ok) {
+        finish_program(stream);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    publish(stream, 1, ok);
+    return NULL;
+}
+
+// Wait until the step at pc is published. Returns 0 if it never will be,
+// -1 if the program failed meanwhile.
+static int wait_for_step(stream_t* stream, context_t* context, int pc, int* published, int* value_count) {
+    int result = 1;
+    
+    pthread_mutex_lock(&stream->lock);
+    while (pc >= stream->published && !stream->finished && !stream->failed) {
+        pthread_cond_wait(&stream->progress, &stream->lock);
+    }
+    if (stream->failed) {
+        result = -1;
+    } else if (pc >= stream->published) {
+        result = 0;
+    }
+    *published = stream->published;
+    int variables = stream->variables;
+    pthread_mutex_unlock(&stream->lock);
+    
+    // Newly parsed steps may use new variables, which start at zero
+    int64_t* values = realloc(context->values, sizeof(int64_t) * (variables > 0 ? variables : 1));
+    if (!values) {
+        runtime_error(context, 0, "out of memory");
+        return -1;
+    }
+    if (variables > *value_count) {
+        memset(values + *value_count, 0, sizeof(int64_t) * (variables - *value_count));
+        *value_count = variables;
+    }
+    context->values = values;
+    return result;
+}
+
+// Find the target of a forward branch, waiting for its label if need be.
+// Returns -1 if the program failed first.
+static int resolve_target(stream_t* stream, step_t* step) {
+    int target;
+    
+    pthread_mutex_lock(&stream->lock);
+    while ((target = find_label(&stream->program, step->text)) == -1 && !stream->failed) {
+        pthread_cond_wait(&stream->progress, &stream->lock);
+    }
+    if (stream->failed) {
+        target = -1;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    step->target = target;
+    return target;
+}
+
+static int is_failed(stream_t* stream) {
+    pthread_mutex_lock(&stream->lock);
+    int failed = stream->failed;
+    pthread_mutex_unlock(&stream->lock);
+    return failed;
+}
+
+// Executor: run the published steps, waiting whenever it gets ahead of the
+// producer. Returns 1 on halt, 0 on a runtime error, -1 if the producer
+// failed.
+static int execute_stream(stream_t* stream, context_t* context) {
+    int published = 0;
+    int value_count = 0;
+    int pc = 0;
+    int jumps = 0;
+    
+#define VALUE(k) (step->literal & (1 << (k)) ? step->operand[k] : values[step->operand[k]])
+    for (;;) {
+        if (pc >= published) {
+            int ready = wait_for_step(stream, context, pc, &published, &value_count);
+            if (ready == 0) {
+                runtime_error(context, 0, "program ended without halt instruction");
+                return 0;
+            }
+            if (ready == -1) {
+                return -1;
+            }
+        }
+        
+        step_t* step = step_at(stream->pages, pc);
+        int64_t* values = context->values;
+        pc++;
+        
+        switch (step->op) {
+            case OP_SET:
+                values[step->operand[0]] = VALUE(1);
+                break;
+                
+#define STEP_ARITH(name, symbol) \
+            case OP_##name: \
+                values[step->operand[0]] = VALUE(1) symbol VALUE(2); \
+                break;
+            ARITH_OPS(STEP_ARITH)
+#undef STEP_ARITH
+
+            case OP_DIV: {
+                int64_t b = VALUE(2);
+                
+                if (b == 0) {
+                    runtime_error(context, step->line, "runtime error: division by zero");
+                    return 0;
+                }
+                values[step->operand[0]] = VALUE(1) / b;
+                break;
+            }
+            
+            case OP_CMP: {
+                int64_t a = VALUE(1);
+                int64_t b = VALUE(2);
+                int64_t result = 0;
+                
+                switch (step->cmp) {
+#define STEP_COMPARE(name, symbol) case CMP_##name: result = a symbol b; break;
+                    COMPARE_OPS(STEP_COMPARE)
+#undef STEP_COMPARE
+                }
+                values[step->operand[0]] = result;
+                break;
+            }
+            
+            case OP_OUT:
+                if (step->text.start) {
+                    output_string(&context->output, step->text.start, step->text.length);
+                } else {
+                    output_integer(&context->output, VALUE(1));
+                }
+                break;
+                
+            case OP_IF:
+                if (VALUE(1) == 0) {
+                    break;
+                }
+                // Fall through
+            case OP_GOTO:
+                if (step->target == -1 && resolve_target(stream, step) == -1) {
+                    return -1;
+                }
+                pc = step->target;
+                
+                // A producer error stops even a program that never waits
+                if (++jumps == STREAM_POLL_JUMPS) {
+                    jumps = 0;
+                    if (is_failed(stream)) {
+                        return -1;
+                    }
+                }
+                break;
+                
+            case OP_HALT:
+                return 1;
+                
+            default:
+                runtime_error(context, step->line, "unknown instruction");
+                return 0;
+        }
+    }
+#undef VALUE
+}
+
+// Run a program while it is still being read from fd: a producer thread
+// parses and validates each line as it arrives, and execution starts on the
+// first one. Errors only found at the end of the input, such as an undefined
+// label, are still reported and fail the run. Returns an exit status.
+int run_stream(int fd, flush_policy_t policy, int quiet) {
+    stream_t* stream = calloc(1, sizeof(stream_t));
+    context_t context;
+    pthread_t producer;
+    
+    if (!stream) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    init_program(&stream->program);
+    stream->fd = fd;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->progress, NULL);
+    
+    // The context only borrows the program for its sink; values grow with it
+    memset(&context, 0, sizeof(context));
+    context.program = &stream->program;
+    context.error_line = -1;
+    output_init(&context.output, &stdio_sink, policy);
+    
+    int result = 0;
+    if (pthread_create(&producer, NULL, parse_stream, stream) != 0) {
+        fprintf(stderr, "Error: cannot start parser thread\n");
+        result = -2;
+    } else {
+        result = execute_stream(stream, &context);
+        output_flush(&context.output);
+        pthread_join(producer, NULL);
+    }
+    
+    int status = 1;
+    if (result == -2) {
+        // Reported above
+    } else if (stream->parse_failed) {
+        fprintf(stderr, "Parsing failed.\n");
+    } else if (stream->failed) {
+        fprintf(stderr, "Validation failed.\n");
+    } else if (result == 0) {
+        fprintf(stderr, "\nExecution failed.\n");
+    } else {
+        status = 0;
+        if (!quiet) {
+            printf("\nProgram completed successfully.\n");
+        }
+    }
+    
+    context_free(&context);
+    for (int i = 0; i < STEP_PAGES && stream->pages[i]; i++) {
+        free(stream->pages[i]);
+    }
+    pthread_cond_destroy(&stream->progress);
+    pthread_mutex_destroy(&stream->lock);
+    free_program(&stream->program);
+    free(stream);
+    return status;
+}
\ No newline at end of file
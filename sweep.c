@@ -0,0 +1,501 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <time.h>
+#include "bareword.h"
+
+/*
+ * Parameter sweeps (--sweep). One program runs once per row of a CSV table
+ * whose header names variables and whose rows hold their starting values.
+ * Rows run SWEEP_LANES at a time in lockstep: every slot holds one lane
+ * per row, so each instruction is dispatched once for the whole group.
+ *
+ * A group runs as one or more splits, each a pc and the set of lanes at it.
+ * Lanes that disagree on a branch split in two. The split with the lowest
+ * pc always runs, and stops when it reaches the pc of a waiting split, so
+ * lanes that left a loop early wait below it for the rest and run on
+ * together.
+ */
+ 
+// Several vectors' worth: 64-bit multiplies and compares have long latency
+// or no vector form at all, and independent lanes keep the pipeline busy
+#define SWEEP_LANES 16
+#define ALL_LANES ((1u << SWEEP_LANES) - 1)
+
+// One value per lane. Every operation is a loop over the lanes with a fixed
+// trip count, which compilers turn into vector instructions.
+typedef struct {
+    int64_t lane[SWEEP_LANES];
+} lanes_t;
+
+#define FOR_LANES(i) for (int i = 0; i < SWEEP_LANES; i++)
+
+// Operands of the current instruction in lane i
+#define A(i) (values[ip->a].lane[i])
+#define B(i) (values[ip->b].lane[i])
+#define IMM(i) IMMEDIATE(ip->b)
+
+// Compute expr for every lane of the destination. Lanes outside the split
+// keep their value, unless no other split is live.
+#define STORE(expr) do { \
+        lanes_t* dst_ = &values[ip->dst]; \
+        if (whole) { \
+            FOR_LANES(i) dst_->lane[i] = (expr); \
+        } else { \
+            FOR_LANES(i) dst_->lane[i] = ((expr) & mask.lane[i]) | (dst_->lane[i] & ~mask.lane[i]); \
+        } \
+    } while (0)
+    
+// Two's complement wrap-around, like the engines
+#define WRAP(a, op, b) ((int64_t)((uint64_t)(a) op (uint64_t)(b)))
+
+typedef struct {
+    int pc;
+    unsigned lanes;             // Bit per lane
+} split_t;
+
+typedef struct {
+    const program_t* program;
+    lanes_t* values;            // One vector per slot
+    split_t splits[SWEEP_LANES];
+    int split_count;
+    output_t outputs[SWEEP_LANES];
+    int error_line[SWEEP_LANES];
+    const char* error[SWEEP_LANES];
+} group_t;
+
+// Starting values: a header of variable names, then one row per run
+typedef struct {
+    char* text;
+    int* slots;                 // Slot of each column
+    int columns;
+    int64_t* rows;              // rows * columns values
+    int row_count;
+} table_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// All ones in the lanes of a split, for blending
+static void lane_mask(unsigned lanes, lanes_t* mask) {
+    FOR_LANES(i) mask->lane[i] = -(int64_t)((lanes >> i) & 1);
+}
+
+// Lanes whose value is nonzero
+static unsigned lanes_of(const lanes_t* values) {
+    unsigned lanes = 0;
+    
+    FOR_LANES(i) lanes |= (unsigned)(values->lane[i] != 0) << i;
+    return lanes;
+}
+
+static void add_split(group_t* group, int pc, unsigned lanes) {
+    for (int i = 0; i < group->split_count; i++) {
+        if (group->splits[i].pc == pc) {
+            group->splits[i].lanes |= lanes;
+            return;
+        }
+    }
+    group->splits[group->split_count].pc = pc;
+    group->splits[group->split_count].lanes = lanes;
+    group->split_count++;
+}
+
+static void fail_lanes(group_t* group, unsigned lanes, int line, const char* message) {
+    for (int i = 0; i < SWEEP_LANES; i++) {
+        if (lanes & (1u << i)) {
+            group->error_line[i] = line;
+            group->error[i] = message;
+        }
+    }
+}
+
+// Run the split with the lowest pc until its lanes halt or fail, or it
+// reaches a pc where another split waits
+static void run_split(group_t* group, int pc, unsigned lanes) {
+    const compiled_t* compiled = &group->program->compiled;
+    const bytecode_t* code = compiled->code;
+    lanes_t* values = group->values;
+    lanes_t mask;
+    int whole = group->split_count == 0;
+    int stop = compiled->count;
+    
+    for (int i = 0; i < group->split_count; i++) {
+        if (group->splits[i].pc < stop) {
+            stop = group->splits[i].pc;
+        }
+    }
+    
+    lane_mask(lanes, &mask);
+    while (pc < stop) {
+        const bytecode_t* ip = &code[pc];
+        unsigned taken;
+        int target;
+        
+        switch (ip->op) {
+            case BC_SET_RR:
+                STORE(A(i));
+                pc++;
+                continue;
+                
+            case BC_SET_RI:
+                STORE(IMM(i));
+                pc++;
+                continue;
+                
+#define ARITH_CASES(name, symbol) \
+            case BC_##name##_RR: \
+                STORE(WRAP(A(i), symbol, B(i))); \
+                pc++; \
+                continue; \
+            case BC_##name##_RI: \
+                STORE(WRAP(A(i), symbol, IMM(i))); \
+                pc++; \
+                continue;
+            ARITH_OPS(ARITH_CASES)
+#undef ARITH_CASES
+
+            // Division has no vector form; only live lanes divide, so an
+            // idle lane holding INT64_MIN / -1 cannot trap
+            case BC_DIV_RR:
+            case BC_DIV_RI: {
+                lanes_t* dst = &values[ip->dst];
+                lanes_t result = *dst;
+                
+                FOR_LANES(i) {
+                    int64_t b = ip->op == BC_DIV_RR ? B(i) : IMM(i);
+                    
+                    if (!(lanes & (1u << i))) {
+                        continue;
+                    }
+                    if (b == 0) {
+                        fail_lanes(group, 1u << i, compiled->lines[pc], "runtime error: division by zero");
+                        lanes &= ~(1u << i);
+                        continue;
+                    }
+                    result.lane[i] = A(i) / b;
+                }
+                if (!lanes) {
+                    return;
+                }
+                lane_mask(lanes, &mask);
+                *dst = result;
+                pc++;
+                continue;
+            }
+            
+#define COMPARE_CASES(name, symbol) \
+            case BC_CMP_##name##_RR: \
+                STORE(A(i) symbol B(i)); \
+                pc++; \
+                continue; \
+            case BC_CMP_##name##_RI: \
+                STORE(A(i) symbol IMM(i)); \
+                pc++; \
+                continue;
+            COMPARE_OPS(COMPARE_CASES)
+#undef COMPARE_CASES
+
+            // Fused compare-and-branch, the following word holds the target
+#define BRANCH_CASES(name, symbol) \
+            case BC_BR_##name##_RR: \
+            case BC_BR_##name##_RI: { \
+                if (ip->op & 1) { \
+                    STORE(A(i) symbol IMM(i)); \
+                } else { \
+                    STORE(A(i) symbol B(i)); \
+                } \
+                taken = lanes & lanes_of(&values[ip->dst]); \
+                target = ip[1].dst; \
+                pc++; \
+                break; \
+            }
+            COMPARE_OPS(BRANCH_CASES)
+#undef BRANCH_CASES
+
+            case BC_OUT_R:
+                FOR_LANES(i) {
+                    if (lanes & (1u << i)) {
+                        output_integer(&group->outputs[i], A(i));
+                    }
+                }
+                pc++;
+                continue;
+                
+            case BC_OUT_S:
+                FOR_LANES(i) {
+                    if (lanes & (1u << i)) {
+                        output_string(&group->outputs[i], &compiled->strings[ip->a], ip->b);
+                    }
+                }
+                pc++;
+                continue;
+                
+            case BC_IF:
+                taken = lanes & lanes_of(&values[ip->a]);
+                target = ip->dst;
+                break;
+                
+            case BC_GOTO:
+                taken = lanes;
+                target = ip->dst;
+                break;
+                
+            case BC_HALT:
+                return;
+                
+            default:
+                fail_lanes(group, lanes, compiled->lines[pc], "unknown instruction");
+                return;
+        }
+        
+        // A jump. Lanes that disagree split, and the lower half goes on as
+        // long as it stays below every waiting split.
+        unsigned fall = lanes & ~taken;
+        pc++;
+        if (taken && fall) {
+            int low = target < pc ? target : pc;
+            int high = target < pc ? pc : target;
+            
+            add_split(group, high, target < pc ? fall : taken);
+            lanes = target < pc ? taken : fall;
+            pc = low;
+            stop = high < stop ? high : stop;
+            whole = 0;
+            lane_mask(lanes, &mask);
+        } else if (taken) {
+            pc = target;
+        }
+    }
+    
+    if (pc < compiled->count) {
+        add_split(group, pc, lanes); // Joins or waits behind the split at stop
+    } else {
+        fail_lanes(group, lanes, 0, "program ended without halt instruction");
+    }
+}
+
+// Run rows [first, first + count) as one group
+static void run_group(group_t* group, const table_t* table, int first, int count) {
+    const program_t* program = group->program;
+    const compiled_t* compiled = &program->compiled;
+    
+    memset(group->values, 0, sizeof(lanes_t) * compiled->slot_count);
+    for (int i = 0; i < compiled->constant_count; i++) {
+        FOR_LANES(lane) group->values[program->variable_count + i].lane[lane] = compiled->constants[i];
+    }
+    for (int lane = 0; lane < count; lane++) {
+        const int64_t* row = &table->rows[(size_t)(first + lane) * table->columns];
+        
+        for (int c = 0; c < table->columns; c++) {
+            group->values[table->slots[c]].lane[lane] = row[c];
+        }
+        group->error[lane] = NULL;
+        group->error_line[lane] = -1;
+    }
+    
+    group->split_count = 1;
+    group->splits[0].pc = 0;
+    group->splits[0].lanes = ALL_LANES >> (SWEEP_LANES - count);
+    while (group->split_count > 0) {
+        int lowest = 0;
+        
+        for (int i = 1; i < group->split_count; i++) {
+            if (group->splits[i].pc < group->splits[lowest].pc) {
+                lowest = i;
+            }
+        }
+        split_t split = group->splits[lowest];
+        group->splits[lowest] = group->splits[--group->split_count];
+        run_split(group, split.pc, split.lanes);
+    }
+}
+
+static int find_variable(const program_t* program, span_t name) {
+    for (int i = 0; i < program->variable_count; i++) {
+        span_t symbol = program->symbols[i].name;
+        if (symbol.length == name.length && memcmp(symbol.start, name.start, name.length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Next comma-separated field of a line, whitespace trimmed
+static span_t next_field(char** cursor, char* end) {
+    char* start = *cursor;
+    char* stop = start;
+    span_t field;
+    
+    while (stop < end && *stop != ',') stop++;
+    *cursor = stop < end ? stop + 1 : end;
+    while (start < stop && isspace((unsigned char)*start)) start++;
+    while (stop > start && isspace((unsigned char)stop[-1])) stop--;
+    field.start = start;
+    field.length = (int)(stop - start);
+    return field;
+}
+
+static void free_table(table_t* table) {
+    free(table->text);
+    free(table->slots);
+    free(table->rows);
+}
+
+static int read_table(const program_t* program, const char* path, table_t* table) {
+    FILE* file = fopen(path, "rb");
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t n;
+    
+    memset(table, 0, sizeof(*table));
+    if (!file) {
+        fprintf(stderr, "Error: cannot open sweep table '%s'\n", path);
+        return 0;
+    }
+    do {
+        if (capacity - size < 4096) {
+            capacity = capacity > 0 ? capacity * 2 : 65536;
+            char* grown = realloc(table->text, capacity + 1);
+            if (!grown) {
+                fclose(file);
+                fprintf(stderr, "Error: out of memory\n");
+                return 0;
+            }
+            table->text = grown;
+        }
+        n = fread(table->text + size, 1, capacity - size, file);
+        size += n;
+    } while (n > 0);
+    fclose(file);
+    table->text[size] = '\0';
+    
+    int row_capacity = 0;
+    int line_number = 0;
+    for (char* line = table->text; line < table->text + size;) {
+        char* end = strchr(line, '\n');
+        char* next = end ? end + 1 : table->text + size;
+        if (!end) {
+            end = table->text + size;
+        }
+        line_number++;
+        
+        char* cursor = line;
+        span_t first = next_field(&cursor, end);
+        if (first.length == 0 && cursor == end) {
+            line = next; // Blank line
+            continue;
+        }
+        cursor = line;
+        
+        if (!table->slots) {
+            // Header: the variables each column sets
+            for (char* p = line; p < end; p++) {
+                table->columns += *p == ',';
+            }
+            table->columns++;
+            table->slots = malloc(sizeof(int) * table->columns);
+            if (!table->slots) {
+                fprintf(stderr, "Error: out of memory\n");
+                return 0;
+            }
+            for (int c = 0; c < table->columns; c++) {
+                span_t name = next_field(&cursor, end);
+                table->slots[c] = find_variable(program, name);
+                if (table->slots[c] == -1) {
+                    fprintf(stderr, "Error: sweep table '%s': '%.*s' is not a variable of the program\n", path,
+                            name.length, name.start);
+                    return 0;
+                }
+            }
+        } else {
+            if (table->row_count == row_capacity) {
+                row_capacity = row_capacity > 0 ? row_capacity * 2 : 1024;
+                int64_t* grown = realloc(table->rows, sizeof(int64_t) * table->columns * row_capacity);
+                if (!grown) {
+                    fprintf(stderr, "Error: out of memory\n");
+                    return 0;
+                }
+                table->rows = grown;
+            }
+            
+            int64_t* row = &table->rows[(size_t)table->row_count * table->columns];
+            for (int c = 0; c < table->columns; c++) {
+                span_t field = next_field(&cursor, end);
+                char* stop;
+                
+                // The field ends at a comma or the line end, never at a digit
+                errno = 0;
+                row[c] = field.length > 0 ? strtoll(field.start, &stop, 10) : 0;
+                if (field.length == 0 || stop != field.start + field.length || errno == ERANGE ||
+                    (c == table->columns - 1) != (cursor == end)) {
+                    fprintf(stderr, "Error: sweep table '%s' line %d: expected %d integers\n", path, line_number,
+                            table->columns);
+                    return 0;
+                }
+            }
+            table->row_count++;
+        }
+        line = next;
+    }
+    
+    if (!table->slots) {
+        fprintf(stderr, "Error: sweep table '%s' has no header\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+int run_sweep(const program_t* program, const char* table_path) {
+    table_t table;
+    group_t group;
+    int failed = 0;
+    
+    if (!read_table(program, table_path, &table)) {
+        free_table(&table);
+        return 1;
+    }
+    
+    group.program = program;
+    if (posix_memalign((void**)&group.values, sizeof(lanes_t),
+                       sizeof(lanes_t) * (program->compiled.slot_count + 1)) != 0) {
+        fprintf(stderr, "Error: out of memory\n");
+        free_table(&table);
+        return 1;
+    }
+    for (int i = 0; i < SWEEP_LANES; i++) {
+        output_init(&group.outputs[i], &stdio_sink, FLUSH_EXIT);
+    }
+    
+    double start = now();
+    for (int first = 0; first < table.row_count; first += SWEEP_LANES) {
+        int count = table.row_count - first < SWEEP_LANES ? table.row_count - first : SWEEP_LANES;
+        
+        run_group(&group, &table, first, count);
+        
+        // Rows in order, each output followed by its error
+        for (int lane = 0; lane < count; lane++) {
+            printf("==> row %d: %s\n", first + lane + 1, group.error[lane] ? "runtime error" : "ok");
+            fflush(stdout);
+            output_flush(&group.outputs[lane]);
+            if (group.error[lane]) {
+                span_t none = { NULL, 0 };
+                stdio_sink.error(stdio_sink.user, group.error_line[lane], group.error[lane], none);
+                failed++;
+            }
+        }
+    }
+    double elapsed = now() - start;
+    
+    fprintf(stderr, "\nSweep: %d rows, %d ok, %d failed in %.3f s, %d lanes (%.0f rows/s)\n", table.row_count,
+            table.row_count - failed, failed, elapsed, SWEEP_LANES, elapsed > 0 ? table.row_count / elapsed : 0.0);
+            
+    for (int i = 0; i < SWEEP_LANES; i++) {
+        output_free(&group.outputs[i]);
+    }
+    free(group.values);
+    free_table(&table);
+    return failed > 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bareword.h"
+
+/*
+ * Execution traces (--trace). The tracing engine stores one 16-byte record
+ * per instruction into a ring buffer that is a shared mapping of the trace
+ * file, so the history is in the file even if the process dies. Records
+ * hold the pc, the slot written and its new value; the opcode and line of
+ * every pc, the variable names and the source path are written once after
+ * the ring, so --dump-trace can decode a trace without the program.
+ *
+ * Like images, traces are only readable by a build with the same byte order
+ * and layout.
+ */
+ 
+#define TRACE_MAGIC "BWT"
+#define TRACE_VERSION 1
+#define TRACE_BYTE_ORDER 0x01020304u
+#define TRACE_ALIGN 16
+
+#define ALIGN_UP(n) (((n) + TRACE_ALIGN - 1) & ~(uint64_t)(TRACE_ALIGN - 1))
+
+typedef struct {
+    char magic[4];              // TRACE_MAGIC, NUL-terminated
+    uint32_t version;           // TRACE_VERSION
+    uint32_t byte_order;        // TRACE_BYTE_ORDER as stored by the producer
+    uint32_t header_size;       // sizeof(trace_header_t)
+    uint64_t head;              // Records written so far, the newest at (head - 1) % capacity
+    uint32_t status;            // trace_status_t
+    uint32_t capacity;          // Records in the ring, a power of two
+    int32_t code_count;
+    int32_t variable_count;
+    uint64_t records_offset;    // Section offsets from the start of the file
+    uint64_t lines_offset;
+    uint64_t ops_offset;
+    uint64_t names_offset;      // NUL-terminated variable names in slot order
+    uint64_t source_offset;     // NUL-terminated path of the source, empty if none
+    uint64_t trace_size;
+} trace_header_t;
+
+static const char* const status_names[] = { "still running or crashed", "halted", "runtime error" };
+
+// Create path holding an empty ring of capacity records for the program
+trace_t* trace_open(const char* path, const program_t* program, const char* source_name, uint32_t capacity) {
+    const compiled_t* compiled = &program->compiled;
+    trace_header_t header;
+    uint64_t names_size = 0;
+    
+    if (!program->symbols) {
+        source_name = ""; // Images keep no names and are not worth listing
+    }
+    for (int i = 0; program->symbols && i < program->variable_count; i++) {
+        names_size += program->symbols[i].name.length + 1;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.byte_order = TRACE_BYTE_ORDER;
+    header.header_size = sizeof(header);
+    header.status = TRACE_RUNNING;
+    header.capacity = capacity;
+    header.code_count = compiled->count;
+    header.variable_count = program->symbols ? program->variable_count : 0;
+    header.records_offset = ALIGN_UP(sizeof(header));
+    header.lines_offset = header.records_offset + (uint64_t)capacity * sizeof(trace_record_t);
+    header.ops_offset = ALIGN_UP(header.lines_offset + sizeof(int) * compiled->count);
+    header.names_offset = ALIGN_UP(header.ops_offset + compiled->count);
+    header.source_offset = header.names_offset + names_size;
+    header.trace_size = header.source_offset + strlen(source_name) + 1;
+    
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, header.trace_size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    char* data = mmap(NULL, header.trace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    
+    trace_t* trace = malloc(sizeof(trace_t));
+    if (!trace) {
+        munmap(data, header.trace_size);
+        return NULL;
+    }
+    
+    // The file starts out zeroed, so only the tables need filling in
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + header.lines_offset, compiled->lines, sizeof(int) * compiled->count);
+    for (int pc = 0; pc < compiled->count; pc++) {
+        data[header.ops_offset + pc] = compiled->code[pc].op;
+    }
+    char* name = data + header.names_offset;
+    for (int i = 0; i < header.variable_count; i++) {
+        span_t symbol = program->symbols[i].name;
+        memcpy(name, symbol.start, symbol.length);
+        name += symbol.length + 1;
+    }
+    strcpy(data + header.source_offset, source_name);
+    
+    trace_header_t* mapped = (trace_header_t*)data;
+    trace->records = (trace_record_t*)(data + header.records_offset);
+    trace->mask = capacity - 1;
+    trace->head = &mapped->head;
+    trace->status = &mapped->status;
+    trace->map = data;
+    trace->map_size = header.trace_size;
+    return trace;
+}
+
+void trace_close(trace_t* trace) {
+    if (trace) {
+        munmap(trace->map, trace->map_size);
+        free(trace);
+    }
+}
+
+// Name of a lowered opcode, without its BC_ prefix
+static const char* opcode_name(int op) {
+    static const char* const names[] = {
+#define ARITH_NAMES(name, symbol) #name "_RR", #name "_RI",
+#define COMPARE_NAMES(name, symbol) "CMP_" #name "_RR", "CMP_" #name "_RI",
+#define BRANCH_NAMES(name, symbol) "BR_" #name "_RR", "BR_" #name "_RI",
+        "SET_RR", "SET_RI",
+        ARITH_OPS(ARITH_NAMES)
+        "DIV_RR", "DIV_RI",
+        COMPARE_OPS(COMPARE_NAMES)
+        COMPARE_OPS(BRANCH_NAMES)
+        "OUT_R", "OUT_S", "IF", "GOTO", "HALT"
+#undef ARITH_NAMES
+#undef COMPARE_NAMES
+#undef BRANCH_NAMES
+    };
+    
+    return op >= 0 && op < BC_COUNT ? names[op] : "?";
+}
+
+// Whether the mapped file is a complete trace this build can read
+static int check_trace(const char* data, size_t size) {
+    const trace_header_t* header = (const trace_header_t*)data;
+    
+    if (size < sizeof(*header) || memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        header->version != TRACE_VERSION || header->byte_order != TRACE_BYTE_ORDER ||
+        header->header_size != sizeof(*header) || header->trace_size != size) {
+        return 0;
+    }
+    if (header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0 || header->code_count < 0 ||
+        header->variable_count < 0 ||
+        header->lines_offset != header->records_offset + (uint64_t)header->capacity * sizeof(trace_record_t) ||
+        header->lines_offset + sizeof(int) * (uint64_t)header->code_count > header->ops_offset ||
+        header->ops_offset + header->code_count > header->names_offset ||
+        header->names_offset > header->source_offset || header->source_offset >= size ||
+        data[size - 1] != '\0') {
+        return 0;
+    }
+    return 1;
+}
+
+// List the last steps of a trace, at most limit of them (0 for all it
+// holds), oldest first, each with its source line and the value it stored.
+// Returns -1 if the file cannot be read and 0 if it is not a trace
+int dump_trace(const char* path, uint64_t limit, FILE* out) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size <= 0) {
+        close(fd);
+        return 0;
+    }
+    const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    if (!check_trace(data, st.st_size)) {
+        munmap((void*)data, st.st_size);
+        return 0;
+    }
+    
+    const trace_header_t* header = (const trace_header_t*)data;
+    const trace_record_t* records = (const trace_record_t*)(data + header->records_offset);
+    const int* lines = (const int*)(data + header->lines_offset);
+    const uint8_t* ops = (const uint8_t*)(data + header->ops_offset);
+    const char* source_name = data + header->source_offset;
+    uint64_t head = header->head;
+    uint64_t count = head < header->capacity ? head : header->capacity;
+    
+    // Variable names in slot order
+    const char** names = calloc(header->variable_count + 1, sizeof(char*));
+    const char* name = data + header->names_offset;
+    for (int i = 0; names && i < header->variable_count && name < source_name; i++) {
+        names[i] = name;
+        name += strlen(name) + 1;
+    }
+    
+    // The source, for the text of each line, if it can still be read
+    program_t program;
+    int source_lines = 0;
+    const char** starts = NULL;
+    init_program(&program);
+    if (*source_name && load_source(source_name, &program)) {
+        starts = index_source(&program, &source_lines);
+    }
+    
+    if (limit > 0 && count > limit) {
+        count = limit;
+    }
+    fprintf(out, "Trace of '%s': %llu steps, %s; the last %llu:\n\n", *source_name ? source_name : "(image)",
+            (unsigned long long)head, header->status <= TRACE_FAILED ? status_names[header->status] : "?",
+            (unsigned long long)count);
+    fprintf(out, "  %12s  %6s  %-9s  %-32s  %s\n", "Step", "Line", "Op", "Source", "Stored");
+    for (uint64_t step = head - count; step < head; step++) {
+        const trace_record_t* record = &records[step & (header->capacity - 1)];
+        int valid = record->pc < (uint32_t)header->code_count;
+        int line = valid ? lines[record->pc] : 0;
+        span_t text = line_text(starts, source_lines, line);
+        char stored[64] = "";
+        
+        // A names table cut short leaves the rest of the slots unnamed
+        if (record->slot != TRACE_NO_SLOT && names && record->slot < (uint32_t)header->variable_count &&
+            names[record->slot]) {
+            snprintf(stored, sizeof(stored), "%.32s = %lld", names[record->slot], (long long)record->value);
+        } else if (record->slot != TRACE_NO_SLOT) {
+            snprintf(stored, sizeof(stored), "slot %u = %lld", record->slot, (long long)record->value);
+        }
+        fprintf(out, "  %12llu  %6d  %-9s  %-32.*s  %s\n", (unsigned long long)step + 1, line,
+                valid ? opcode_name(ops[record->pc]) : "?", text.length, text.start ? text.start : "", stored);
+    }
+    
+    free(starts);
+    free(names);
+    free_program(&program);
+    munmap((void*)data, st.st_size);
+    return 1;
+}
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include "bareword.h"
+
+/*
+ * Ahead-of-time translation to C (--emit-c). The validated program becomes
+ * one standalone translation unit: every variable a local in main(), every
+ * branch target a C label and if/goto native gotos, so the system compiler
+ * sees the whole program at once.
+ *
+ * The generated code keeps the interpreter's semantics: variables start at
+ * zero, arithmetic wraps, comparisons yield 0 or 1, and runtime errors print
+ * the interpreter's message with the source line and exit with status 1.
+ */
+
+static const char* const c_comparisons[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+// Runtime support emitted ahead of main()
+static const char* const prelude =
+    "#include <inttypes.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "\n"
+    "static void bw_error(int line, const char* message) {\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"Error at line %d: %s\\n\", line, message);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "// Two's complement wrap-around, like the interpreter on every supported target\n"
+    "static inline int64_t bw_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }\n"
+    "static inline int64_t bw_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }\n"
+    "static inline int64_t bw_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }\n"
+    "\n"
+    "static inline int64_t bw_div(int64_t a, int64_t b, int line) {\n"
+    "    if (b == 0) {\n"
+    "        bw_error(line, \"runtime error: division by zero\");\n"
+    "    }\n"
+    "    return a / b;\n"
+    "}\n"
+    "\n";
+    
+// Variables and labels keep their names where those are C identifiers, and
+// are numbered otherwise; the prefixes keep both apart from C keywords
+static void emit_variable(const program_t* program, int slot, FILE* out) {
+    span_t name = program->symbols[slot].name;
+    
+    if (is_valid_identifier(name)) {
+        fprintf(out, "v_%.*s", name.length, name.start);
+    } else {
+        fprintf(out, "v%d", slot);
+    }
+}
+
+static void emit_label(const program_t* program, const int* label_of, int index, FILE* out) {
+    if (label_of[index] != -1) {
+        span_t name = program->labels[label_of[index]].name;
+        fprintf(out, "L_%.*s", name.length, name.start);
+    } else {
+        fprintf(out, "L%d", index);
+    }
+}
+
+// A variable, or the literal exactly as lowering would read it
+static void emit_value(const program_t* program, const instruction_t* inst, int index, FILE* out) {
+    if (inst->slots[index] != -1) {
+        emit_variable(program, inst->slots[index], out);
+        return;
+    }
+    
+    int64_t value = parse_integer(inst->args[index]);
+    if (value == INT64_MIN) {
+        fprintf(out, "INT64_MIN");
+    } else {
+        fprintf(out, "INT64_C(%lld)", (long long)value);
+    }
+}
+
+// String literal with everything but plain printable ASCII escaped; '?' too,
+// so no trigraph can form
+static void emit_string(span_t str, FILE* out) {
+    fputc('"', out);
+    for (int i = 0; i < str.length; i++) {
+        unsigned char c = str.start[i];
+        
+        if (c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%c", c);
+        } else if (c >= 0x20 && c < 0x7F) {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+    fputs("\\n\"", out);
+}
+
+int emit_c(const program_t* program, const char* source_name, FILE* out) {
+    int count = program->instruction_count;
+    char* target = calloc(count + 1, 1);
+    int* label_of = malloc(sizeof(int) * (count + 1));
+    
+    if (!target || !label_of) {
+        free(target);
+        free(label_of);
+        print_error(program->sink, 0, "out of memory", "");
+        return 0;
+    }
+    
+    // Name each branch target after the first label there
+    for (int i = 0; i <= count; i++) {
+        label_of[i] = -1;
+    }
+    for (int i = program->label_count - 1; i >= 0; i--) {
+        if (is_valid_identifier(program->labels[i].name)) {
+            label_of[program->labels[i].instruction_index] = i;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const instruction_t* inst = &program->instructions[i];
+        
+        if (inst->op == OP_IF || inst->op == OP_GOTO) {
+            target[inst->target] = 1;
+        }
+    }
+    
+    fprintf(out, "// Generated by bareword --emit-c from %s\n", source_name);
+    fputs(prelude, out);
+    fputs("int main(void) {\n", out);
+    for (int i = 0; i < program->variable_count; i++) {
+        fputs("    int64_t ", out);
+        emit_variable(program, i, out);
+        fputs(" = 0;\n", out);
+    }
+    fputs("\n", out);
+    
+    for (int i = 0; i <= count; i++) {
+        if (target[i]) {
+            emit_label(program, label_of, i, out);
+            fputs(":\n", out);
+        }
+        if (i == count) {
+            break;
+        }
+        
+        const instruction_t* inst = &program->instructions[i];
+        fputs("    ", out);
+        
+        switch (inst->op) {
+            case OP_SET:
+                emit_variable(program, inst->slots[0], out);
+                fputs(" = ", out);
+                emit_value(program, inst, 1, out);
+                fputs(";\n", out);
+                break;
+                
+            case OP_OUT:
+                if (is_text_operand(inst)) {
+                    fputs("fputs(", out);
+                    emit_string(inst->args[0], out);
+                    fputs(", stdout);\n", out);
+                } else {
+                    fputs("printf(\"%\" PRId64 \"\\n\", ", out);
+                    emit_value(program, inst, 0, out);
+                    fputs(");\n", out);
+                }
+                break;
+                
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+                emit_variable(program, inst->slots[0], out);
+                fprintf(out, " = bw_%s(", inst->op == OP_ADD ? "add" : inst->op == OP_SUB ? "sub" :
+                                          inst->op == OP_MUL ? "mul" : "div");
+                emit_value(program, inst, 1, out);
+                fputs(", ", out);
+                emit_value(program, inst, 2, out);
+                if (inst->op == OP_DIV) {
+                    fprintf(out, ", %d", inst->line_number);
+                }
+                fputs(");\n", out);
+                break;
+                
+            case OP_CMP:
+                emit_variable(program, inst->slots[0], out);
+                fputs(" = ", out);
+                emit_value(program, inst, 1, out);
+                fprintf(out, " %s ", c_comparisons[inst->cmp]);
+                emit_value(program, inst, 3, out);
+                fputs(";\n", out);
+                break;
+                
+            case OP_IF:
+                fputs("if (", out);
+                emit_variable(program, inst->slots[0], out);
+                fputs(") goto ", out);
+                emit_label(program, label_of, inst->target, out);
+                fputs(";\n", out);
+                break;
+                
+            case OP_GOTO:
+                fputs("goto ", out);
+                emit_label(program, label_of, inst->target, out);
+                fputs(";\n", out);
+                break;
+                
+            case OP_HALT:
+            default:
+                fputs("return 0;\n", out);
+                break;
+        }
+    }
+    
+    fputs("    bw_error(0, \"program ended without halt instruction\");\n", out);
+    fputs("    return 1;\n", out);
+    fputs("}\n", out);
+    free(target);
+    free(label_of);
+    
+    fflush(out);
+    return !ferror(out);
+}
\ No newline at end of file
@@ -1,115 +1,327 @@
 #include "bareword.h"
 
-int find_label(program_t* program, const char* name) {
-    for (int i = 0; i < program->label_count; i++) {
-        if (strcmp(program->labels[i].name, name) == 0) {
-            return program->labels[i].instruction_index;
+static int spans_equal(span_t a, span_t b) {
+    return a.length == b.length && memcmp(a.start, b.start, a.length) == 0;
+}
+
+static uint32_t hash_name(span_t name) {
+    return (uint32_t)hash_source(name.start, name.length);
+}
+
+// Position of the label called name in program->labels, -1 if undefined
+static int label_entry(const program_t* program, span_t name) {
+    const hash_index_t* index = &program->label_index;
+    uint32_t hash = hash_name(name);
+    
+    if (!index->entries) {
+        return -1;
+    }
+    for (const hash_entry_t* entry = hash_index_probe(index, hash); entry->item; entry = hash_index_next(index, entry)) {
+        if (entry->hash == hash && spans_equal(program->labels[entry->item - 1].name, name)) {
+            return entry->item - 1;
         }
     }
     return -1;
 }
 
-int validate_program(program_t* program) {
-    // Check for duplicate labels
-    for (int i = 0; i < program->label_count; i++) {
-        for (int j = i + 1; j < program->label_count; j++) {
-            if (strcmp(program->labels[i].name, program->labels[j].name) == 0) {
-                print_error(0, "duplicate label", program->labels[i].name);
-                return 0;
+int find_label(program_t* program, span_t name) {
+    int label = label_entry(program, name);
+    return label == -1 ? -1 : program->labels[label].instruction_index;
+}
+
+int intern_symbol(program_t* program, span_t name) {
+    hash_index_t* index = &program->symbol_index;
+    uint32_t hash = hash_name(name);
+    
+    if (!hash_index_reserve(&program->arena, index, program->variable_count + 1)) {
+        return -1;
+    }
+    hash_entry_t* entry = hash_index_probe(index, hash);
+    for (; entry->item; entry = hash_index_next(index, entry)) {
+        if (entry->hash == hash && spans_equal(program->symbols[entry->item - 1].name, name)) {
+            return entry->item - 1;
+        }
+    }
+    
+    symbol_t* symbols = arena_reserve(&program->arena, program->symbols, program->variable_count + 1,
+                                      &program->symbol_capacity, sizeof(symbol_t));
+    if (!symbols) {
+        return -1;
+    }
+    program->symbols = symbols;
+    
+    // Names point into the source, which lives as long as the program
+    program->symbols[program->variable_count].name = name;
+    hash_index_insert(index, entry, program->variable_count, hash);
+    return program->variable_count++;
+}
+
+static int is_branch(const instruction_t* inst) {
+    return inst->op == OP_IF || inst->op == OP_GOTO;
+}
+
+static int is_branch_code(const bytecode_t* code) {
+    return code->op == BC_IF || code->op == BC_GOTO;
+}
+
+void build_cfg(program_t* program) {
+    const compiled_t* compiled = &program->compiled;
+    int* block_of = program->block_of;
+    
+    // Leaders: the entry, every branch target and every instruction after a branch or halt
+    for (int i = 0; i <= compiled->count; i++) {
+        block_of[i] = 0;
+    }
+    block_of[0] = 1;
+    for (int i = 0; i < compiled->count; i++) {
+        const bytecode_t* code = &compiled->code[i];
+        
+        if (is_branch_code(code)) {
+            block_of[code->dst] = 1;
+        }
+        if (is_branch_code(code) || code->op == BC_HALT) {
+            block_of[i + 1] = 1;
+        }
+    }
+    
+    // Number the blocks and record their extents
+    program->block_count = 0;
+    for (int i = 0; i < compiled->count; i++) {
+        if (block_of[i]) {
+            block_t* block = &program->blocks[program->block_count];
+            block->start = i;
+            block->successor_count = 0;
+            program->block_count++;
+        }
+        program->blocks[program->block_count - 1].end = i + 1;
+        block_of[i] = program->block_count - 1;
+    }
+    block_of[compiled->count] = -1; // Falling off the end
+    
+    // Connect each block to its successors
+    for (int b = 0; b < program->block_count; b++) {
+        block_t* block = &program->blocks[b];
+        const bytecode_t* last = &compiled->code[block->end - 1];
+        
+        if (is_branch_code(last) && block_of[last->dst] != -1) {
+            block->successors[block->successor_count++] = block_of[last->dst];
+        }
+        if (last->op != BC_GOTO && last->op != BC_HALT && block_of[block->end] != -1) {
+            block->successors[block->successor_count++] = block_of[block->end];
+        }
+    }
+}
+
+// Whether an out prints its argument as text: a quoted string, or an
+// operator or other token that is neither a variable nor an integer.
+// Only meaningful once the instruction is validated.
+int is_text_operand(const instruction_t* inst) {
+    return inst->slots[0] == -1 && inst->types[0] != TOKEN_INTEGER;
+}
+
+// Which arguments of an instruction may name a variable
+static int is_variable_operand(const instruction_t* inst, int index) {
+    span_t arg = inst->args[index];
+    
+    switch (inst->op) {
+        case OP_SET:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            break;
+        case OP_CMP:
+            if (index == 2) return 0; // Comparison operator
+            break;
+        case OP_IF:
+            return index == 0;
+        case OP_OUT:
+            // Quoted strings are printed verbatim even when they look like a
+            // name; unquoted names, keywords included, are variables
+            return inst->types[0] != TOKEN_STRING && is_valid_identifier(arg);
+        default:
+            return 0;
+    }
+    
+    // Integer literals stay literals
+    return !(isdigit(arg.start[0]) || (arg.start[0] == '-' && arg.length > 1 && isdigit(arg.start[1])));
+}
+
+// Which argument of an instruction names a label, -1 if none
+static int label_operand(const instruction_t* inst) {
+    switch (inst->op) {
+        case OP_IF:
+            return 2;
+        case OP_GOTO:
+        case OP_LABEL:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Checks of one instruction that need no other instructions: literal
+// division by zero and identifiers. Variable operands are resolved to
+// slots. Returns the number of errors reported, -1 without memory.
+int validate_instruction(program_t* program, instruction_t* inst) {
+    int named = label_operand(inst);
+    int errors = 0;
+    
+    if (inst->op == OP_DIV && span_equals(inst->args[2], "0")) {
+        print_error(program->sink, inst->line_number, "division by zero", "");
+        errors++;
+    }
+    
+    for (int j = 0; j < 4; j++) {
+        inst->slots[j] = -1;
+        if (j >= inst->arg_count) {
+            continue;
+        }
+        
+        // Strings, integers and comparison operators need no checking;
+        // out's operand was classified by the lexer
+        int variable = is_variable_operand(inst, j);
+        if ((variable && inst->op != OP_OUT) || j == named) {
+            if (!is_valid_identifier(inst->args[j])) {
+                print_error_span(program->sink, inst->line_number, "invalid identifier", inst->args[j]);
+                errors++;
+                continue;
+            }
+        }
+        
+        if (variable) {
+            inst->slots[j] = intern_symbol(program, inst->args[j]);
+            if (inst->slots[j] == -1) {
+                print_error(program->sink, inst->line_number, "out of memory", "");
+                return -1;
             }
         }
     }
+    return errors;
+}
+
+// Add program->labels[label] to the label index. Returns 0 if a label of
+// that name is already indexed, -1 without memory.
+int index_label(program_t* program, int label) {
+    hash_index_t* index = &program->label_index;
+    span_t name = program->labels[label].name;
+    uint32_t hash = hash_name(name);
+    
+    if (!hash_index_reserve(&program->arena, index, index->count + 1)) {
+        return -1;
+    }
+    hash_entry_t* entry = hash_index_probe(index, hash);
+    for (; entry->item; entry = hash_index_next(index, entry)) {
+        if (entry->hash == hash && spans_equal(program->labels[entry->item - 1].name, name)) {
+            return 0;
+        }
+    }
+    hash_index_insert(index, entry, label, hash);
+    return 1;
+}
+
+// Index the labels by name, reporting every one defined more than once
+static int index_labels(program_t* program, int* errors) {
+    hash_index_t* index = &program->label_index;
+    
+    memset(index, 0, sizeof(*index));
+    if (!hash_index_reserve(&program->arena, index, program->label_count)) {
+        return 0;
+    }
+    for (int i = 0; i < program->label_count; i++) {
+        int added = index_label(program, i);
+        if (added == -1) {
+            return 0;
+        }
+        if (!added) {
+            print_error_span(program->sink, 0, "duplicate label", program->labels[i].name);
+            (*errors)++;
+        }
+    }
+    return 1;
+}
+
+// Check every instruction in one pass, reporting all errors rather than the
+// first. The same pass resolves variables to dense slots, so execution never
+// looks up names, and drops labels from the executed stream.
+int validate_program(program_t* program) {
+    int errors = 0;
+    int has_halt = 0;
+    int count = 0;      // Instructions kept so far
+    int label = 0;      // Labels are listed in the order they appear
+    
+    if (!index_labels(program, &errors)) {
+        print_error(program->sink, 0, "out of memory", "");
+        return 0;
+    }
+    program->variable_count = 0;
+    memset(&program->symbol_index, 0, sizeof(program->symbol_index));
     
-    // Validate all instructions
     for (int i = 0; i < program->instruction_count; i++) {
         instruction_t* inst = &program->instructions[i];
+        int named = label_operand(inst);
         
         switch (inst->op) {
-            case OP_IF:
-                // Check if the label exists
-                if (find_label(program, inst->args[2]) == -1) {
-                    print_error(inst->line_number, "undefined label", inst->args[2]);
-                    return 0;
-                }
+            case OP_LABEL:
+                // Branches land on the instruction after the label
+                program->labels[label++].instruction_index = count;
                 break;
                 
+            case OP_IF:
             case OP_GOTO:
-                // Check if the label exists
-                if (find_label(program, inst->args[0]) == -1) {
-                    print_error(inst->line_number, "undefined label", inst->args[0]);
-                    return 0;
-                }
-                break;
-                
-            case OP_CMP:
-                // Validate comparison operator
-                if (string_to_comparison(inst->args[2]) == -1) {
-                    print_error(inst->line_number, "invalid comparison operator", inst->args[2]);
-                    return 0;
+                // Resolved to the label's position for now, patched below
+                inst->target = label_entry(program, inst->args[named]);
+                if (inst->target == -1) {
+                    print_error_span(program->sink, inst->line_number, "undefined label", inst->args[named]);
+                    errors++;
                 }
                 break;
                 
-            case OP_DIV:
-                // Check for division by zero with literal values
-                if (strcmp(inst->args[2], "0") == 0) {
-                    print_error(inst->line_number, "division by zero", "");
-                    return 0;
-                }
+            case OP_HALT:
+                has_halt = 1;
                 break;
                 
             default:
                 break;
         }
-    }
-    
-    // Check that program has at least one halt instruction
-    int has_halt = 0;
-    for (int i = 0; i < program->instruction_count; i++) {
-        if (program->instructions[i].op == OP_HALT) {
-            has_halt = 1;
-            break;
+        
+        int found = validate_instruction(program, inst);
+        if (found == -1) {
+            return 0;
+        }
+        errors += found;
+        
+        if (inst->op != OP_LABEL) {
+            if (count != i) {
+                program->instructions[count] = *inst;
+            }
+            count++;
         }
     }
     
+    // Check that program has at least one halt instruction
     if (!has_halt) {
-        print_error(0, "program must contain at least one 'halt' instruction", "");
+        print_error(program->sink, 0, "program must contain at least one 'halt' instruction", "");
+        errors++;
+    }
+    if (errors > 0) {
         return 0;
     }
+    program->instruction_count = count;
     
-    // Validate identifier names
+    // Patch every branch with the index its label now has
     for (int i = 0; i < program->instruction_count; i++) {
         instruction_t* inst = &program->instructions[i];
-        
-        for (int j = 0; j < inst->arg_count; j++) {
-            char* arg = inst->args[j];
-            
-            // Skip string literals (handled by parser already)
-            if (inst->op == OP_OUT && j == 0) {
-                continue; // OUT instruction can take strings, variables, or integers
-            }
-            
-            // Skip integers
-            if (isdigit(arg[0]) || (arg[0] == '-' && isdigit(arg[1]))) {
-                continue;
-            }
-            
-            // Skip comparison operators
-            if (string_to_comparison(arg) != -1) {
-                continue;
-            }
-            
-            // Skip 'goto' keyword
-            if (strcmp(arg, "goto") == 0) {
-                continue;
-            }
-            
-            // Validate identifier
-            if (!is_valid_identifier(arg)) {
-                print_error(inst->line_number, "invalid identifier", arg);
-                return 0;
-            }
+        if (is_branch(inst)) {
+            inst->target = program->labels[inst->target].instruction_index;
         }
     }
     
+    if (!lower_program(program)) {
+        print_error(program->sink, 0, "out of memory", "");
+        return 0;
+    }
+    build_cfg(program);
+    
     return 1;
 }
\ No newline at end of file